@@ -0,0 +1,215 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#define nullptr NULL
+
+#include "simulation.h"
+#include "trajectory.h"
+
+static long double getTime() {
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	return (long double) now.tv_sec + (long double) now.tv_nsec * 1e-9;
+}
+
+// Largest difference of the positions and velocities of a system between two simulations, negative on failure
+static double maxParticleDifference(struct Simulation * a, struct Simulation * b, cl_uint system) {
+	const struct Particle * particlesA = getSimulationParticles(a, system);
+	if (particlesA == nullptr) {
+		return -1;
+	}
+
+	// The particles of a are only valid until the next call on it, b is a different simulation
+	struct Particle copy[numberParticles];
+	memcpy(copy, particlesA, sizeof(copy));
+
+	const struct Particle * particlesB = getSimulationParticles(b, system);
+	if (particlesB == nullptr) {
+		return -1;
+	}
+
+	double difference = 0;
+	for (cl_uint i = 0; i < numberParticles; i++) {
+		difference = fmax(difference, fabs(copy[i].position.x - particlesB[i].position.x));
+		difference = fmax(difference, fabs(copy[i].position.y - particlesB[i].position.y));
+		difference = fmax(difference, fabs(copy[i].velocity.x - particlesB[i].velocity.x));
+		difference = fmax(difference, fabs(copy[i].velocity.y - particlesB[i].velocity.y));
+	}
+
+	return difference;
+}
+
+// Runs the same events with the fused pair times and with the compacted matrix, the events must agree
+static int crossCheckSimulations(struct Simulation * fused, struct Simulation * matrix, cl_uint systems,
+                                 cl_uint events) {
+	if (setSimulationFusedIntersectionTime(fused, true) != EXIT_SUCCESS
+	    || setSimulationFusedIntersectionTime(matrix, false) != EXIT_SUCCESS
+	    || loadSimulationInitialConditions(fused, 22) != EXIT_SUCCESS
+	    || loadSimulationInitialConditions(matrix, 22) != EXIT_SUCCESS
+	    || advanceSimulationEvents(fused, events) != EXIT_SUCCESS
+	    || advanceSimulationEvents(matrix, events) != EXIT_SUCCESS) {
+		return EXIT_FAILURE;
+	}
+
+	// Both paths pick the same event from the same float times, only the order of the additions may differ
+	double difference = 0;
+	for (cl_uint system = 0; system < systems; system++) {
+		const double systemDifference = maxParticleDifference(fused, matrix, system);
+		if (systemDifference < 0) {
+			return EXIT_FAILURE;
+		}
+		difference = fmax(difference, systemDifference);
+	}
+
+	const struct CandidateCounters candidates = getSimulationStatistics(matrix).candidateTotals;
+	printf("pair times cross-check: %u events, max difference %g, %u candidate overflows\n", events, difference,
+	       candidates.overflows);
+
+	if (difference > 1e-3) {
+		printf("Error: The fused and matrix pair times diverged!\n");
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+static int crossCheckPairTimes(cl_uint systems, cl_uint events) {
+	struct Simulation * fused = createSimulation(true, systems);
+	if (fused == nullptr) {
+		return EXIT_FAILURE;
+	}
+
+	struct Simulation * matrix = createSimulation(true, systems);
+	if (matrix == nullptr) {
+		destroySimulation(fused);
+		return EXIT_FAILURE;
+	}
+
+	const int result = crossCheckSimulations(fused, matrix, systems, events);
+
+	destroySimulation(matrix);
+	destroySimulation(fused);
+
+	return result;
+}
+
+// Usage: CollisionBasedGasBenchmark [systems] [events] [reorder interval] [neighbor skin] [trajectory file]
+//        [persistent events] [pair times: fused, matrix or check]
+// check runs a short cross-check of the fused and the matrix pair times before the benchmark, which uses the default
+int main(int argc, char ** argv) {
+	const cl_uint systems = argc > 1 ? (cl_uint) strtoul(argv[1], nullptr, 10) : 1;
+	const cl_uint events = argc > 2 ? (cl_uint) strtoul(argv[2], nullptr, 10) : 1000;
+	const char * trajectoryPath = argc > 5 && argv[5][0] != '\0' ? argv[5] : nullptr;
+	const char * pairTimesMode = argc > 7 ? argv[7] : "";
+
+	if (strcmp(pairTimesMode, "check") == 0 && crossCheckPairTimes(systems, 100) != EXIT_SUCCESS) {
+		return EXIT_FAILURE;
+	}
+
+	struct Simulation * simulation = createSimulation(true, systems);
+	if (simulation == nullptr) {
+		return EXIT_FAILURE;
+	}
+
+	// The simulation keeps its defaults for the arguments that are not given
+	if (argc > 3) {
+		setSimulationReorderInterval(simulation, (cl_uint) strtoul(argv[3], nullptr, 10));
+	}
+
+	if (argc > 4 && setSimulationNeighborSkin(simulation, strtof(argv[4], nullptr)) != EXIT_SUCCESS) {
+		destroySimulation(simulation);
+		return EXIT_FAILURE;
+	}
+
+	if (argc > 6 && setSimulationPersistentEvents(simulation, (cl_uint) strtoul(argv[6], nullptr, 10)) != EXIT_SUCCESS) {
+		destroySimulation(simulation);
+		return EXIT_FAILURE;
+	}
+
+	if ((strcmp(pairTimesMode, "fused") == 0 || strcmp(pairTimesMode, "matrix") == 0)
+	    && setSimulationFusedIntersectionTime(simulation, strcmp(pairTimesMode, "fused") == 0) != EXIT_SUCCESS) {
+		destroySimulation(simulation);
+		return EXIT_FAILURE;
+	}
+
+	const cl_uint interval = getSimulationReorderInterval(simulation);
+	const cl_float skin = getSimulationNeighborSkin(simulation);
+	const cl_uint persistent = getSimulationPersistentEvents(simulation);
+
+	if (loadSimulationInitialConditions(simulation, 22) != EXIT_SUCCESS) {
+		destroySimulation(simulation);
+		return EXIT_FAILURE;
+	}
+
+	if (trajectoryPath != nullptr
+	    && recordSimulationTrajectory(simulation, trajectoryPath, trajectoryKeyframeInterval) != EXIT_SUCCESS) {
+		destroySimulation(simulation);
+		return EXIT_FAILURE;
+	}
+
+	const double initialLocality = getSimulationLocality(simulation);
+
+	const long double start = getTime();
+
+	if (advanceSimulationEvents(simulation, events) != EXIT_SUCCESS) {
+		destroySimulation(simulation);
+		return EXIT_FAILURE;
+	}
+
+	const long double elapsed = getTime() - start;
+
+	if (stopSimulationTrajectory(simulation) != EXIT_SUCCESS) {
+		destroySimulation(simulation);
+		return EXIT_FAILURE;
+	}
+
+	const double finalLocality = getSimulationLocality(simulation);
+	const struct SimulationStatistics statistics = getSimulationStatistics(simulation);
+
+	printf("%u systems of %u particles, %u events, reorder interval %u, neighbor skin %.2f, %s pair times, %u wide\n",
+	       systems, numberParticles, events, interval, skin, getSimulationFusedIntersectionTime(simulation) ? "fused" : "matrix of",
+	       getSimulationPairVectorWidth(simulation));
+	printf("time: %.3Lfs, %.4Lfms per event, %.0Lf particle events per second\n", elapsed,
+	       elapsed * 1000 / events, (long double) events * systems * numberParticles / elapsed);
+	printf("persistent launches: %s\n", persistent > 0 && skin == 0 ? "yes" : "no");
+	printf("reorders: %lu in %.3Lfms\n", (unsigned long) statistics.reorders, statistics.reorderTime);
+	printf("locality (mean distance between consecutive slots): %.2f initial, %.2f final (%.1f%% gain)\n",
+	       initialLocality, finalLocality,
+	       initialLocality > 0 ? 100.0 * (initialLocality - finalLocality) / initialLocality : 0.0);
+
+	const struct CandidateCounters * candidates = &statistics.candidateTotals;
+	if (candidates->steps > 0) {
+		const double pairTimes = (double) numberParticles * (numberParticles + 1) / 2;
+		const double perStep = (double) candidates->entries / candidates->steps;
+		printf("candidates: %.2f per step out of %.0f pair and wall times (%.2f%%), %u steps overflowed\n", perStep,
+		       pairTimes, 100.0 * perStep / pairTimes, candidates->overflows);
+	}
+
+	if (skin > 0) {
+		const struct NeighborCounters * neighbors = &statistics.neighborTotals;
+		printf("neighbor lists: %u rebuilds (every %.1f events), %.2f partners on average, %u full lists\n",
+		       neighbors->rebuilds,
+		       neighbors->rebuilds == 0 ? 0.0 : (double) statistics.iteration * systems / neighbors->rebuilds,
+		       neighbors->rebuilds == 0 ?
+		           0.0 : (double) neighbors->entries / ((double) neighbors->rebuilds * numberParticles),
+		       neighbors->overflows);
+	}
+
+	if (trajectoryPath != nullptr) {
+		FILE * file = fopen(trajectoryPath, "rb");
+		if (file != nullptr && fseek(file, 0, SEEK_END) == 0) {
+			printf("trajectory: %ld bytes\n", ftell(file));
+		}
+		if (file != nullptr) {
+			fclose(file);
+		}
+	}
+
+	destroySimulation(simulation);
+
+	return EXIT_SUCCESS;
+}
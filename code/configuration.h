@@ -0,0 +1,75 @@
+#ifndef COLLISIONBASEDGASSIMULATOR_CONFIGURATION_H
+#define COLLISIONBASEDGASSIMULATOR_CONFIGURATION_H
+
+#include <stdbool.h>
+
+#include <CL/cl.h>
+
+#include "datatypes.h"
+#include "trace.h"
+
+// Tuning of the implementation, only included by simulation.c, embedders see datatypes.h through simulation.h
+// All the definitions here must also be in simulator.cl, or be passed to it as build options
+
+// Steps between reads of the outcome counters
+static const cl_uint outcomeCountersInterval = 10;
+// Work groups of the kernels that count outcomes, the pair matrix is split in squares of outcomeGroupSide pairs a side
+static const cl_uint outcomeGroupSize = 64;
+static const cl_uint outcomeGroupSide = 8;
+
+// Default steps between Morton reorders of the particle buffers, 0 disables reordering
+static const cl_uint reorderInterval = 0;
+// Chunks every system is split in by the radix sort of the reorder
+static const cl_uint radixChunks = 16;
+// Digits of the radix sort, must match RADIX_BITS, the Morton codes are 32 bits long
+static const cl_uint radixBits = 4;
+static const cl_uint radixDigits = 16;
+static const cl_uint radixPasses = 8;
+
+// Default skin of the neighbor lists, 0 tests every pair on every event instead
+static const cl_float neighborSkin = 0;
+static const cl_uint maxNeighbors = 32;
+
+// Computes and reduces the pair times in one kernel without the numberParticles² matrix, false keeps the matrix.
+// Default of setSimulationFusedIntersectionTime
+static const bool fusedIntersectionTime = true;
+// Work group size of the fused kernel, must match FUSED_GROUP_SIZE
+static const cl_uint fusedGroupSize = 64;
+
+// Only with the matrix, findMin reduces a dense list of the times below the end of the step instead of the whole
+// matrix, false walks the matrix
+static const bool compactCandidates = true;
+// Work group size of the compaction kernels, must match CANDIDATE_GROUP_SIZE
+static const cl_uint candidateGroupSize = 64;
+// Room for the candidates of every system, per particle. A step with more candidates is counted as an overflow and
+// findMinFused walks the matrix instead
+static const cl_uint candidatesPerParticle = 8;
+
+// Partners tested at once by every work item of the pair kernels, 0 uses CL_DEVICE_PREFERRED_VECTOR_WIDTH_FLOAT
+// rounded down to 1, 2, 4, 8 or 16. 1 keeps the scalar code, which is also used when every test is traced
+static const cl_uint pairVectorWidth = 0;
+
+// Default steps run by every launch of the persistent kernel, 0 launches the kernels of every step from the host
+static const cl_uint persistentEvents = 0;
+// Steps advanceSimulationBatch enqueues between reads of the horizons, it stops once every system reached its time
+static const cl_uint batchCheckInterval = 32;
+
+// Passed to simulator.cl as build options, the kernels contain no trace code with TRACE_LEVEL_OFF
+static const enum TraceLevel traceLevel = TRACE_LEVEL_OFF;
+static const cl_uint traceCapacity = 4096; // Must be a power of two, openTraceWriter rejects anything else
+static const char* const traceFilePath = "trace.bin";
+
+struct __attribute__((packed)) Collision {
+	enum CollisionType type;
+	cl_uint indexB;
+};
+
+// First event of a work group of the fused kernel, also a candidate of the compacted matrix
+struct __attribute__((packed)) FusedWinner {
+	Time time;
+	cl_uint indexA;
+	cl_uint indexB;
+	enum CollisionType type;
+};
+
+#endif //COLLISIONBASEDGASSIMULATOR_CONFIGURATION_H
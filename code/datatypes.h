@@ -1,17 +1,20 @@
 #ifndef COLLISIONBASEDGASSIMULATOR_DATATYPES_H
 #define COLLISIONBASEDGASSIMULATOR_DATATYPES_H
 
+#include <stdbool.h>
+
 #include <CL/cl.h>
 
+// Public types and dimensions of the simulation, the tuning of the implementation is in configuration.h
 // All the definitions here must also be in simulator.cl
 
-const cl_uint width = 500;
-const cl_uint height = 500;
+static const cl_uint width = 500;
+static const cl_uint height = 500;
 
-const cl_uint numberParticles = 20;
+static const cl_uint numberParticles = 20;
 
-const cl_float radius = 20;
-const cl_float dt = 0.5f;
+static const cl_float radius = 20;
+static const cl_float dt = 0.5f;
 
 struct __attribute__((packed)) Particle {
 	cl_float2 position;
@@ -28,9 +31,44 @@ enum CollisionType {
 	PARTICLE_WALL_Y
 };
 
-struct __attribute__((packed)) Collision {
-	enum CollisionType type;
+enum Outcome {
+	OUTCOME_OVERLAP = 0,
+	OUTCOME_NO_INTERSECT,
+	OUTCOME_GLANCING,
+	OUTCOME_GETTING_FARTHER,
+	OUTCOME_COLLISION,
+	OUTCOME_COUNT
+};
+
+// Accumulated on the device over the whole simulation, the values wrap around
+struct __attribute__((packed)) OutcomeCounters {
+	cl_uint pair[OUTCOME_COUNT];
+	cl_uint wall[OUTCOME_COUNT];
+};
+
+// Written by the kernels for every system on every step, type is NONE when the step ended without a collision. The
+// indices are particle ids and the velocities are the ones after the collision, B is A for walls
+struct __attribute__((packed)) EventRecord {
+	cl_uint type; // enum CollisionType
+	cl_uint indexA;
 	cl_uint indexB;
+	cl_float2 velocityA;
+	cl_float2 velocityB;
+};
+
+// Totals since the simulation was created, every system counts its own rebuilds
+struct __attribute__((packed)) NeighborCounters {
+	cl_uint rebuilds;
+	cl_uint overflows; // Lists that did not fit in maxNeighbors, their particles tested every partner instead
+	cl_uint entries; // Sum of the list lengths over all the builds
+};
+
+// Totals since the simulation was created, summed over the systems, only counted by the fused kernel and the
+// compaction of the matrix
+struct __attribute__((packed)) CandidateCounters {
+	cl_uint steps;
+	cl_uint entries; // Pair and wall times below the end of their step, the only ones that could be the next event
+	cl_uint overflows; // Steps of a system whose candidates did not fit in its list, it walked the matrix instead
 };
 
 #endif //COLLISIONBASEDGASSIMULATOR_DATATYPES_H
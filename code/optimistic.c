@@ -0,0 +1,1284 @@
+#include "optimistic.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#define nullptr NULL
+
+// Events in OptimisticWorker.nextPartners that are not collisions between particles
+#define OPTIMISTIC_WALL_X (-1)
+#define OPTIMISTIC_WALL_Y (-2)
+#define OPTIMISTIC_CELL_X (-3)
+#define OPTIMISTIC_CELL_Y (-4)
+
+static struct OptimisticSegment moveSegment(const struct OptimisticSegment * segment, double time) {
+	return (struct OptimisticSegment) {
+		.time = time,
+		.x = segment->x + segment->vx * (time - segment->time),
+		.y = segment->y + segment->vy * (time - segment->time),
+		.vx = segment->vx,
+		.vy = segment->vy,
+	};
+}
+
+// Time of the first contact of two particles from time from on, INFINITY if they do not collide. Overlapping pairs
+// are left alone, as on the device. The arithmetic is the same with a and b swapped, so both strips of a collision
+// between strips find the same time
+static double pairTime(const struct OptimisticSegment * a, const struct OptimisticSegment * b, double from) {
+	const struct OptimisticSegment movedA = moveSegment(a, from);
+	const struct OptimisticSegment movedB = moveSegment(b, from);
+
+	const double dx = movedA.x - movedB.x;
+	const double dy = movedA.y - movedB.y;
+	const double dvx = movedA.vx - movedB.vx;
+	const double dvy = movedA.vy - movedB.vy;
+
+	const double b2 = dx * dvx + dy * dvy; // Half of b
+	if (b2 >= 0) {
+		return INFINITY;
+	}
+
+	const double c = dx * dx + dy * dy - 4.0 * radius * radius;
+	if (c <= 0) {
+		return INFINITY;
+	}
+
+	const double a2 = dvx * dvx + dvy * dvy;
+	const double d = b2 * b2 - a2 * c;
+	if (d < 0) {
+		return INFINITY;
+	}
+
+	// The smaller root, written so it does not cancel
+	return from + c / (-b2 + sqrt(d));
+}
+
+static double wallTime(double position, double velocity, double size) {
+	if (velocity > 0) {
+		return fmax(0, (size - radius - position) / velocity);
+	}
+	if (velocity < 0) {
+		return fmax(0, (radius - position) / velocity);
+	}
+	return INFINITY;
+}
+
+// Time until the center leaves the cell at index along one axis. The walls turn it around before the sides of the box
+static double borderTime(double position, double velocity, cl_uint index, cl_uint cells, double size) {
+	if (velocity > 0 && index + 1 < cells) {
+		return fmax(0, ((index + 1) * size - position) / velocity);
+	}
+	if (velocity < 0 && index > 0) {
+		return fmax(0, (index * size - position) / velocity);
+	}
+	return INFINITY;
+}
+
+// Same with a and b swapped
+static void collideSegments(struct OptimisticSegment * a, struct OptimisticSegment * b) {
+	const double dx = a->x - b->x;
+	const double dy = a->y - b->y;
+	const double product = (a->vx - b->vx) * dx + (a->vy - b->vy) * dy;
+	const double scale = product / (dx * dx + dy * dy);
+
+	a->vx -= scale * dx;
+	a->vy -= scale * dy;
+	b->vx += scale * dx;
+	b->vy += scale * dy;
+}
+
+// Makes room for one more of the count items of size bytes
+static bool reserve(void ** items, size_t * capacity, size_t count, size_t size) {
+	if (count < *capacity) {
+		return true;
+	}
+
+	const size_t grown = *capacity == 0 ? 64 : *capacity * 2;
+	void * resized = realloc(*items, grown * size);
+	if (resized == nullptr) {
+		return false;
+	}
+
+	*items = resized;
+	*capacity = grown;
+	return true;
+}
+
+static cl_uint cellColumn(const struct OptimisticEngine * engine, cl_uint cell) {
+	return cell % engine->columns;
+}
+
+static cl_uint cellRow(const struct OptimisticEngine * engine, cl_uint cell) {
+	return cell / engine->columns;
+}
+
+// Column of the strip next to the neighbor
+static cl_uint borderColumn(const struct OptimisticWorker * worker, cl_uint neighbor) {
+	const struct OptimisticEngine * engine = worker->engine;
+	return neighbor < worker->index ? engine->columnStarts[worker->index] : engine->columnStarts[worker->index + 1] - 1;
+}
+
+// The priority queue of the owned particles is a binary heap by next event, ties go to the lower id
+static bool queueBefore(const struct OptimisticWorker * worker, cl_uint a, cl_uint b) {
+	return worker->nextTimes[a] < worker->nextTimes[b] || (worker->nextTimes[a] == worker->nextTimes[b] && a < b);
+}
+
+static void queuePlace(struct OptimisticWorker * worker, cl_uint position, cl_uint p) {
+	worker->queue[position] = p;
+	worker->queuePositions[p] = (cl_int) position;
+}
+
+static void queueSift(struct OptimisticWorker * worker, cl_uint position) {
+	const cl_uint p = worker->queue[position];
+
+	while (position > 0 && queueBefore(worker, p, worker->queue[(position - 1) / 2])) {
+		queuePlace(worker, position, worker->queue[(position - 1) / 2]);
+		position = (position - 1) / 2;
+	}
+
+	while (true) {
+		cl_uint child = 2 * position + 1;
+		if (child >= worker->queueSize) {
+			break;
+		}
+		if (child + 1 < worker->queueSize && queueBefore(worker, worker->queue[child + 1], worker->queue[child])) {
+			child++;
+		}
+		if (!queueBefore(worker, worker->queue[child], p)) {
+			break;
+		}
+
+		queuePlace(worker, position, worker->queue[child]);
+		position = child;
+	}
+
+	queuePlace(worker, position, p);
+}
+
+static void queueInsert(struct OptimisticWorker * worker, cl_uint p) {
+	queuePlace(worker, worker->queueSize++, p);
+	queueSift(worker, worker->queueSize - 1);
+}
+
+static void queueRemove(struct OptimisticWorker * worker, cl_uint p) {
+	const cl_uint position = (cl_uint) worker->queuePositions[p];
+	const cl_uint last = worker->queue[--worker->queueSize];
+	worker->queuePositions[p] = -1;
+
+	if (last != p) {
+		queuePlace(worker, position, last);
+		queueSift(worker, position);
+	}
+}
+
+// Messages are processed by time, then by sender and in the order they were sent
+static bool messageBefore(const struct OptimisticMessage * a, const struct OptimisticMessage * b) {
+	if (a->time != b->time) {
+		return a->time < b->time;
+	}
+	if (a->sender != b->sender) {
+		return a->sender < b->sender;
+	}
+	return a->serial < b->serial;
+}
+
+static void inputSift(struct OptimisticWorker * worker, size_t position) {
+	const struct OptimisticMessage message = worker->inputs[position];
+
+	while (position > 0 && messageBefore(&message, &worker->inputs[(position - 1) / 2])) {
+		worker->inputs[position] = worker->inputs[(position - 1) / 2];
+		position = (position - 1) / 2;
+	}
+
+	while (true) {
+		size_t child = 2 * position + 1;
+		if (child >= worker->inputCount) {
+			break;
+		}
+		if (child + 1 < worker->inputCount && messageBefore(&worker->inputs[child + 1], &worker->inputs[child])) {
+			child++;
+		}
+		if (!messageBefore(&worker->inputs[child], &message)) {
+			break;
+		}
+
+		worker->inputs[position] = worker->inputs[child];
+		position = child;
+	}
+
+	worker->inputs[position] = message;
+}
+
+static bool pushInput(struct OptimisticWorker * worker, struct OptimisticMessage message) {
+	if (!reserve((void **) &worker->inputs, &worker->inputCapacity, worker->inputCount,
+	             sizeof(struct OptimisticMessage))) {
+		return false;
+	}
+
+	worker->inputs[worker->inputCount++] = message;
+	inputSift(worker, worker->inputCount - 1);
+	return true;
+}
+
+static void removeInput(struct OptimisticWorker * worker, size_t position) {
+	worker->inputs[position] = worker->inputs[--worker->inputCount];
+	if (position < worker->inputCount) {
+		inputSift(worker, position);
+	}
+}
+
+static void linkParticle(struct OptimisticWorker * worker, cl_uint p) {
+	struct OptimisticParticle * particle = &worker->particles[p];
+
+	particle->previous = -1;
+	particle->next = worker->cells[particle->cell];
+	if (particle->next >= 0) {
+		worker->particles[particle->next].previous = (cl_int) p;
+	}
+	worker->cells[particle->cell] = (cl_int) p;
+}
+
+static void unlinkParticle(struct OptimisticWorker * worker, cl_uint p) {
+	const struct OptimisticParticle * particle = &worker->particles[p];
+
+	if (particle->previous >= 0) {
+		worker->particles[particle->previous].next = particle->next;
+	} else {
+		worker->cells[particle->cell] = particle->next;
+	}
+	if (particle->next >= 0) {
+		worker->particles[particle->next].previous = particle->previous;
+	}
+}
+
+// Sets a particle without saving it, keeping the cell lists and the queue. A particle that becomes owned has no next
+// event until it is computed
+static void replaceParticle(struct OptimisticWorker * worker, cl_uint p, struct OptimisticParticle state) {
+	struct OptimisticParticle * particle = &worker->particles[p];
+	const bool owned = particle->state == OPTIMISTIC_OWNED;
+
+	if (particle->state != OPTIMISTIC_ABSENT) {
+		unlinkParticle(worker, p);
+	}
+	if (owned && state.state != OPTIMISTIC_OWNED) {
+		queueRemove(worker, p);
+	}
+
+	*particle = state;
+
+	if (state.state != OPTIMISTIC_ABSENT) {
+		linkParticle(worker, p);
+	}
+	if (!owned && state.state == OPTIMISTIC_OWNED) {
+		worker->nextTimes[p] = INFINITY;
+		worker->nextPartners[p] = OPTIMISTIC_WALL_X;
+		queueInsert(worker, p);
+	}
+}
+
+// Every change made by an event or a message goes through here, so a rollback can undo it
+static bool setParticle(struct OptimisticWorker * worker, cl_uint p, struct OptimisticParticle state) {
+	if (!reserve((void **) &worker->undo, &worker->undoCapacity, worker->undoCount, sizeof(struct OptimisticUndo))) {
+		return false;
+	}
+
+	worker->undo[worker->undoCount++] = (struct OptimisticUndo) { .particle = p, .state = worker->particles[p] };
+	replaceParticle(worker, p, state);
+	return true;
+}
+
+// Earliest of the walls, the borders of the cell and the particles in the cells around, owned or ghosts. A collision
+// happens less than a cell apart, so nothing further can come first: whoever gets closer crosses a border before
+static void computeNextEvent(struct OptimisticWorker * worker, cl_uint p) {
+	const struct OptimisticEngine * engine = worker->engine;
+	const struct OptimisticParticle * particle = &worker->particles[p];
+	const struct OptimisticSegment * segment = &particle->segment;
+	const cl_uint column = cellColumn(engine, particle->cell);
+	const cl_uint row = cellRow(engine, particle->cell);
+
+	double best = segment->time + wallTime(segment->x, segment->vx, engine->box.x);
+	cl_int partner = OPTIMISTIC_WALL_X;
+	cl_uint version = 0;
+
+	const double wallY = segment->time + wallTime(segment->y, segment->vy, engine->box.y);
+	if (wallY < best) {
+		best = wallY;
+		partner = OPTIMISTIC_WALL_Y;
+	}
+
+	const double cellX = segment->time + borderTime(segment->x, segment->vx, column, engine->columns,
+	                                                engine->cellWidth);
+	if (cellX < best) {
+		best = cellX;
+		partner = OPTIMISTIC_CELL_X;
+	}
+
+	const double cellY = segment->time + borderTime(segment->y, segment->vy, row, engine->rows, engine->cellHeight);
+	if (cellY < best) {
+		best = cellY;
+		partner = OPTIMISTIC_CELL_Y;
+	}
+
+	for (cl_uint r = row > 0 ? row - 1 : 0; r <= row + 1 && r < engine->rows; r++) {
+		for (cl_uint c = column > 0 ? column - 1 : 0; c <= column + 1 && c < engine->columns; c++) {
+			for (cl_int q = worker->cells[r * engine->columns + c]; q >= 0; q = worker->particles[q].next) {
+				if (q == (cl_int) p) {
+					continue;
+				}
+
+				const struct OptimisticParticle * other = &worker->particles[q];
+				const double t = pairTime(segment, &other->segment, fmax(segment->time, other->segment.time));
+				if (t < best) {
+					best = t;
+					partner = q;
+					version = other->version;
+				}
+			}
+		}
+	}
+
+	worker->nextTimes[p] = best;
+	worker->nextPartners[p] = partner;
+	worker->partnerVersions[p] = version;
+	queueSift(worker, (cl_uint) worker->queuePositions[p]);
+}
+
+// After p changed, p and the owned particles around it that expected it are computed again, the others only check p.
+// Owned particles further away that expected p find out when their event comes, from the version
+static void updateNextEvents(struct OptimisticWorker * worker, cl_uint p) {
+	const struct OptimisticEngine * engine = worker->engine;
+	const struct OptimisticParticle * particle = &worker->particles[p];
+	if (particle->state == OPTIMISTIC_ABSENT) {
+		return;
+	}
+
+	if (particle->state == OPTIMISTIC_OWNED) {
+		computeNextEvent(worker, p);
+	}
+
+	const cl_uint column = cellColumn(engine, particle->cell);
+	const cl_uint row = cellRow(engine, particle->cell);
+	for (cl_uint r = row > 0 ? row - 1 : 0; r <= row + 1 && r < engine->rows; r++) {
+		for (cl_uint c = column > 0 ? column - 1 : 0; c <= column + 1 && c < engine->columns; c++) {
+			for (cl_int q = worker->cells[r * engine->columns + c]; q >= 0; q = worker->particles[q].next) {
+				const struct OptimisticParticle * other = &worker->particles[q];
+				if (q == (cl_int) p || other->state != OPTIMISTIC_OWNED) {
+					continue;
+				}
+
+				if (worker->nextPartners[q] == (cl_int) p) {
+					computeNextEvent(worker, (cl_uint) q);
+					continue;
+				}
+
+				const double t = pairTime(&other->segment, &particle->segment,
+				                          fmax(particle->segment.time, other->segment.time));
+				if (t < worker->nextTimes[q]) {
+					worker->nextTimes[q] = t;
+					worker->nextPartners[q] = (cl_int) p;
+					worker->partnerVersions[q] = particle->version;
+					queueSift(worker, (cl_uint) worker->queuePositions[q]);
+				}
+			}
+		}
+	}
+}
+
+// Wakes the idle workers that can go on, because the global virtual time moved their limit or the engine is done
+static void wakeWorkers(struct OptimisticEngine * engine) {
+	pthread_mutex_lock(&engine->gvtLock);
+	const double limit = fmin(engine->end, engine->gvt + engine->speculation);
+	pthread_mutex_unlock(&engine->gvtLock);
+
+	const bool done = atomic_load(&engine->done);
+	for (cl_uint index = 0; index < engine->workers; index++) {
+		struct OptimisticWorker * worker = &engine->workerStates[index];
+
+		pthread_mutex_lock(&worker->inboxLock);
+		if (worker->idle && (done || worker->idleTime < limit)) {
+			worker->woken = true;
+			pthread_cond_signal(&worker->inboxCondition);
+		}
+		pthread_mutex_unlock(&worker->inboxLock);
+	}
+}
+
+static void fail(struct OptimisticWorker * worker) {
+	worker->success = false;
+	atomic_store(&worker->engine->done, true);
+	wakeWorkers(worker->engine);
+}
+
+// The global virtual time is computed with Fujimoto's algorithm for shared memory. Once a round starts, every worker
+// reports the minimum of its next event, of the messages it did not process and of the ones it sent since the round
+// started, after taking in the messages sent to it. Messages sent after reporting are later than the report. Under
+// gvtLock, true when this was the last report and the global virtual time is updated. A report for a round that
+// finished while it was being prepared is dropped
+static bool reportLocked(struct OptimisticEngine * engine, struct OptimisticWorker * worker, cl_uint round,
+                         double minimum) {
+	if (round != atomic_load(&engine->gvtStarted) || round == atomic_load(&engine->gvtFinished)) {
+		return false;
+	}
+
+	worker->reportedRound = round;
+	engine->gvtMinimum = fmin(engine->gvtMinimum, fmin(minimum, worker->sendMinimum));
+	worker->sendMinimum = INFINITY;
+
+	if (--engine->gvtRemaining > 0) {
+		return false;
+	}
+
+	engine->gvt = fmax(engine->gvt, engine->gvtMinimum);
+	engine->statistics.gvtRounds++;
+	if (engine->gvt >= engine->end) {
+		atomic_store(&engine->done, true);
+	}
+
+	atomic_store(&engine->gvtFinished, round);
+	return true;
+}
+
+static void finishRound(struct OptimisticEngine * engine);
+
+// Idle workers cannot report, the one that starts the round reports for them, from the messages they were sent
+static void startRound(struct OptimisticEngine * engine) {
+	pthread_mutex_lock(&engine->gvtLock);
+	if (atomic_load(&engine->gvtStarted) != atomic_load(&engine->gvtFinished)) {
+		pthread_mutex_unlock(&engine->gvtLock);
+		return;
+	}
+
+	const cl_uint round = atomic_load(&engine->gvtStarted) + 1;
+	engine->gvtRemaining = engine->workers;
+	engine->gvtMinimum = INFINITY;
+	engine->gvtAgain = false;
+	atomic_store(&engine->gvtStarted, round);
+	pthread_mutex_unlock(&engine->gvtLock);
+
+	bool finished = false;
+	for (cl_uint index = 0; index < engine->workers; index++) {
+		struct OptimisticWorker * worker = &engine->workerStates[index];
+
+		pthread_mutex_lock(&worker->inboxLock);
+		if (worker->idle) {
+			double minimum = worker->idleTime;
+			for (size_t i = 0; i < worker->inboxCount; i++) {
+				minimum = fmin(minimum, worker->inbox[i].time);
+			}
+
+			pthread_mutex_lock(&engine->gvtLock);
+			if (worker->reportedRound != round) {
+				finished |= reportLocked(engine, worker, round, minimum);
+			}
+			pthread_mutex_unlock(&engine->gvtLock);
+		}
+		pthread_mutex_unlock(&worker->inboxLock);
+	}
+
+	if (finished) {
+		finishRound(engine);
+	}
+}
+
+static void finishRound(struct OptimisticEngine * engine) {
+	wakeWorkers(engine);
+
+	pthread_mutex_lock(&engine->gvtLock);
+	const bool again = engine->gvtAgain && !atomic_load(&engine->done);
+	engine->gvtAgain = false;
+	pthread_mutex_unlock(&engine->gvtLock);
+
+	if (again) {
+		startRound(engine);
+	}
+}
+
+static bool sameMessage(const struct OptimisticMessage * a, const struct OptimisticMessage * b) {
+	return a->time == b->time && a->type == b->type && a->particle == b->particle && a->cell == b->cell
+	       && memcmp(&a->segment, &b->segment, sizeof(struct OptimisticSegment)) == 0;
+}
+
+static bool sendMessage(struct OptimisticWorker * worker, cl_uint receiver, struct OptimisticMessage message) {
+	struct OptimisticEngine * engine = worker->engine;
+	struct OptimisticWorker * target = &engine->workerStates[receiver];
+
+	message.sender = worker->index;
+	if (message.type == OPTIMISTIC_CANCEL) {
+		worker->statistics.antiMessages++;
+	} else {
+		if (!reserve((void **) &worker->sent, &worker->sentCapacity, worker->sentCount,
+		             sizeof(struct OptimisticSent))) {
+			return false;
+		}
+
+		// The pending messages before the time of the strip are cancelled, so the ones at the front have its time
+		for (size_t i = worker->pendingStart; i < worker->pendingCount
+		                                      && worker->pending[i].message.time == message.time; i++) {
+			if (worker->pending[i].receiver != receiver || !sameMessage(&worker->pending[i].message, &message)) {
+				continue;
+			}
+
+			worker->sent[worker->sentCount++] = worker->pending[i];
+			worker->pending[i] = worker->pending[worker->pendingStart++];
+			worker->statistics.keptMessages++;
+			return true;
+		}
+
+		message.serial = worker->serials++;
+		worker->sent[worker->sentCount++] = (struct OptimisticSent) { .receiver = receiver, .message = message };
+	}
+	worker->statistics.messages++;
+
+	pthread_mutex_lock(&target->inboxLock);
+	const bool success = reserve((void **) &target->inbox, &target->inboxCapacity, target->inboxCount,
+	                             sizeof(struct OptimisticMessage));
+	if (success) {
+		target->inbox[target->inboxCount++] = message;
+		pthread_cond_signal(&target->inboxCondition);
+	}
+	pthread_mutex_unlock(&target->inboxLock);
+
+	// In flight for the round if the receiver already reported, only checked after the message is in the inbox
+	if (atomic_load(&engine->gvtStarted) != atomic_load(&engine->gvtFinished)) {
+		pthread_mutex_lock(&engine->gvtLock);
+		const cl_uint round = atomic_load(&engine->gvtStarted);
+		if (round != atomic_load(&engine->gvtFinished) && worker->reportedRound != round) {
+			worker->sendMinimum = fmin(worker->sendMinimum, message.time);
+		}
+		pthread_mutex_unlock(&engine->gvtLock);
+	}
+
+	return success;
+}
+
+// Tells the neighbors about p after an event changed it, column is where it was before, engine->columns if it was not
+// owned here. A neighbor next to the column of p gets the new state, one that stops seeing p drops it and one that
+// p crossed into owns it. except already knows, it does the same collision
+static bool notifyNeighbors(struct OptimisticWorker * worker, cl_uint p, cl_uint column, cl_uint except) {
+	const struct OptimisticEngine * engine = worker->engine;
+	const struct OptimisticParticle * particle = &worker->particles[p];
+	const cl_uint current = cellColumn(engine, particle->cell);
+
+	bool success = true;
+	for (cl_uint side = 0; side < 2; side++) {
+		if ((side == 0 && worker->index == 0) || (side == 1 && worker->index + 1 == engine->workers)) {
+			continue;
+		}
+
+		const cl_uint neighbor = side == 0 ? worker->index - 1 : worker->index + 1;
+		if (neighbor == except) {
+			continue;
+		}
+
+		const cl_uint border = borderColumn(worker, neighbor);
+		struct OptimisticMessage message = {
+			.time = worker->now, .particle = p, .cell = particle->cell, .segment = particle->segment,
+		};
+
+		if (particle->state != OPTIMISTIC_OWNED && engine->columnOwners[current] == neighbor) {
+			message.type = OPTIMISTIC_MIGRATE;
+		} else if (particle->state == OPTIMISTIC_OWNED && current == border) {
+			message.type = OPTIMISTIC_UPDATE;
+		} else if (column == border) {
+			message.type = OPTIMISTIC_REMOVE;
+		} else {
+			continue;
+		}
+
+		success &= sendMessage(worker, neighbor, message);
+	}
+
+	return success;
+}
+
+// Anti-messages of the pending messages before time, the strip got past them without sending them again
+static bool cancelPending(struct OptimisticWorker * worker, double time) {
+	bool success = true;
+	while (worker->pendingStart < worker->pendingCount && worker->pending[worker->pendingStart].message.time < time) {
+		const struct OptimisticSent * pending = &worker->pending[worker->pendingStart++];
+		struct OptimisticMessage cancel = pending->message;
+		cancel.type = OPTIMISTIC_CANCEL;
+		success &= sendMessage(worker, pending->receiver, cancel);
+	}
+
+	if (worker->pendingStart == worker->pendingCount) {
+		worker->pendingStart = 0;
+		worker->pendingCount = 0;
+	}
+
+	return success;
+}
+
+static struct OptimisticProcessed * beginProcessed(struct OptimisticWorker * worker, double time) {
+	// Predictions a rounding error in the past are done at the time of the strip, so it never goes back
+	if (!cancelPending(worker, fmax(worker->now, time))
+	    || !reserve((void **) &worker->processed, &worker->processedCapacity, worker->processedCount,
+	                sizeof(struct OptimisticProcessed))) {
+		return nullptr;
+	}
+
+	worker->now = fmax(worker->now, time);
+
+	struct OptimisticProcessed * processed = &worker->processed[worker->processedCount++];
+	*processed = (struct OptimisticProcessed) {
+		.time = worker->now, .undo = worker->undoCount, .sent = worker->sentCount,
+	};
+	return processed;
+}
+
+// The next event of p, which is owned here. A collision with a ghost is also done by the strip that owns it, each
+// changing its own particle and its copy of the other
+static bool processEvent(struct OptimisticWorker * worker, cl_uint p) {
+	const struct OptimisticEngine * engine = worker->engine;
+	const double time = worker->nextTimes[p];
+	const cl_int partner = worker->nextPartners[p];
+
+	if (partner >= 0 && (worker->particles[partner].state == OPTIMISTIC_ABSENT
+	                     || worker->particles[partner].version != worker->partnerVersions[p])) {
+		computeNextEvent(worker, p);
+		return true;
+	}
+
+	struct OptimisticProcessed * processed = beginProcessed(worker, time);
+	if (processed == nullptr) {
+		return false;
+	}
+
+	struct OptimisticParticle particle = worker->particles[p];
+	const cl_uint column = cellColumn(engine, particle.cell);
+	const cl_uint row = cellRow(engine, particle.cell);
+
+	bool success = true;
+	if (partner == OPTIMISTIC_WALL_X || partner == OPTIMISTIC_WALL_Y) {
+		particle.segment = moveSegment(&particle.segment, time);
+		if (partner == OPTIMISTIC_WALL_X) {
+			particle.segment.vx = -particle.segment.vx;
+		} else {
+			particle.segment.vy = -particle.segment.vy;
+		}
+		particle.version = ++worker->versions;
+		processed->events = 1;
+
+		success &= setParticle(worker, p, particle);
+		success &= notifyNeighbors(worker, p, column, engine->workers);
+		updateNextEvents(worker, p);
+	} else if (partner == OPTIMISTIC_CELL_X || partner == OPTIMISTIC_CELL_Y) {
+		cl_uint newColumn = column;
+		cl_uint newRow = row;
+		if (partner == OPTIMISTIC_CELL_X) {
+			newColumn = particle.segment.vx > 0 ? column + 1 : column - 1;
+		} else {
+			newRow = particle.segment.vy > 0 ? row + 1 : row - 1;
+		}
+		particle.cell = newRow * engine->columns + newColumn;
+
+		// Handed over to the neighbor, it stays here as a ghost in the column next to this strip
+		if (engine->columnOwners[newColumn] != worker->index) {
+			particle.state = OPTIMISTIC_GHOST;
+		}
+
+		success &= setParticle(worker, p, particle);
+		success &= notifyNeighbors(worker, p, column, engine->workers);
+		updateNextEvents(worker, p);
+	} else {
+		const cl_uint q = (cl_uint) partner;
+		struct OptimisticParticle other = worker->particles[q];
+		const cl_uint otherColumn = cellColumn(engine, other.cell);
+
+		particle.segment = moveSegment(&particle.segment, time);
+		other.segment = moveSegment(&other.segment, time);
+		collideSegments(&particle.segment, &other.segment);
+		particle.version = ++worker->versions;
+		other.version = ++worker->versions;
+
+		success &= setParticle(worker, p, particle);
+		success &= setParticle(worker, q, other);
+		if (other.state == OPTIMISTIC_OWNED) {
+			processed->events = 1;
+			success &= notifyNeighbors(worker, p, column, engine->workers);
+			success &= notifyNeighbors(worker, q, otherColumn, engine->workers);
+		} else {
+			const cl_uint owner = engine->columnOwners[otherColumn];
+			processed->events = worker->index < owner;
+			processed->stripEvents = worker->index < owner;
+			success &= notifyNeighbors(worker, p, column, owner);
+		}
+
+		updateNextEvents(worker, p);
+		updateNextEvents(worker, q);
+	}
+
+	return success;
+}
+
+static bool processMessage(struct OptimisticWorker * worker, struct OptimisticMessage message) {
+	struct OptimisticProcessed * processed = beginProcessed(worker, message.time);
+	if (processed == nullptr) {
+		return false;
+	}
+
+	processed->isMessage = true;
+	processed->message = message;
+
+	struct OptimisticParticle particle = worker->particles[message.particle];
+	if (message.type == OPTIMISTIC_REMOVE) {
+		// Owned particles that expected it find out from the version when their event comes
+		particle.state = OPTIMISTIC_ABSENT;
+		return setParticle(worker, message.particle, particle);
+	}
+
+	particle.segment = message.segment;
+	particle.cell = message.cell;
+	particle.state = message.type == OPTIMISTIC_MIGRATE ? OPTIMISTIC_OWNED : OPTIMISTIC_GHOST;
+	particle.version = ++worker->versions;
+
+	bool success = setParticle(worker, message.particle, particle);
+	updateNextEvents(worker, message.particle);
+
+	// The sender keeps it as a ghost on its own, the neighbor on the other side may now see it
+	if (message.type == OPTIMISTIC_MIGRATE) {
+		success &= notifyNeighbors(worker, message.particle, worker->engine->columns, message.sender);
+	}
+
+	return success;
+}
+
+static int compareSent(const void * a, const void * b) {
+	const struct OptimisticMessage * messageA = &((const struct OptimisticSent *) a)->message;
+	const struct OptimisticMessage * messageB = &((const struct OptimisticSent *) b)->message;
+	if (messageA->time != messageB->time) {
+		return messageA->time < messageB->time ? -1 : 1;
+	}
+	return (messageA->serial > messageB->serial) - (messageA->serial < messageB->serial);
+}
+
+// Undoes everything processed at time or later, the messages go back to the inputs and what the undone events sent
+// waits to be sent again or cancelled. The particles restored and the owned ones around them are computed again
+static bool rollback(struct OptimisticWorker * worker, double time) {
+	bool success = true;
+	cl_uint restoredCount = 0;
+
+	worker->statistics.rollbacks++;
+	while (worker->processedCount > 0 && worker->processed[worker->processedCount - 1].time >= time) {
+		const struct OptimisticProcessed processed = worker->processed[--worker->processedCount];
+
+		for (size_t u = worker->undoCount; u-- > processed.undo;) {
+			const struct OptimisticUndo * undo = &worker->undo[u];
+			replaceParticle(worker, undo->particle, undo->state);
+
+			if (!worker->restored[undo->particle]) {
+				worker->restored[undo->particle] = true;
+				worker->restoredList[restoredCount++] = undo->particle;
+			}
+		}
+		worker->undoCount = processed.undo;
+
+		for (size_t s = processed.sent; s < worker->sentCount; s++) {
+			if (!reserve((void **) &worker->pending, &worker->pendingCapacity, worker->pendingCount,
+			             sizeof(struct OptimisticSent))) {
+				return false;
+			}
+			worker->pending[worker->pendingCount++] = worker->sent[s];
+		}
+		worker->sentCount = processed.sent;
+
+		if (processed.isMessage) {
+			success &= pushInput(worker, processed.message);
+		}
+		worker->statistics.rolledBackEvents += processed.events;
+	}
+
+	worker->now = worker->processedCount > 0 ? worker->processed[worker->processedCount - 1].time
+	                                          : worker->committed;
+
+	qsort(worker->pending + worker->pendingStart, worker->pendingCount - worker->pendingStart,
+	      sizeof(struct OptimisticSent), compareSent);
+
+	for (cl_uint k = 0; k < restoredCount; k++) {
+		worker->restored[worker->restoredList[k]] = false;
+		updateNextEvents(worker, worker->restoredList[k]);
+	}
+
+	return success;
+}
+
+// Annihilates the message with the serial of the anti-message, rolling back first if it was processed
+static bool cancelMessage(struct OptimisticWorker * worker, const struct OptimisticMessage * cancel) {
+	for (size_t k = worker->processedCount; k-- > 0;) {
+		const struct OptimisticProcessed * processed = &worker->processed[k];
+		if (processed->isMessage && processed->message.sender == cancel->sender
+		    && processed->message.serial == cancel->serial) {
+			if (!rollback(worker, processed->time)) {
+				return false;
+			}
+			break;
+		}
+	}
+
+	for (size_t i = 0; i < worker->inputCount; i++) {
+		if (worker->inputs[i].sender == cancel->sender && worker->inputs[i].serial == cancel->serial) {
+			removeInput(worker, i);
+			return true;
+		}
+	}
+
+	// Messages between two workers arrive in the order they were sent, so the message was here
+	printf("Error: Anti-message without its message!\n");
+	return false;
+}
+
+// Takes in the messages sent to the worker, a straggler rolls it back first
+static bool receiveMessages(struct OptimisticWorker * worker) {
+	pthread_mutex_lock(&worker->inboxLock);
+	struct OptimisticMessage * received = worker->inbox;
+	const size_t receivedCount = worker->inboxCount;
+	const size_t receivedCapacity = worker->inboxCapacity;
+	worker->inbox = worker->received;
+	worker->inboxCapacity = worker->receivedCapacity;
+	worker->inboxCount = 0;
+	worker->received = received;
+	worker->receivedCapacity = receivedCapacity;
+	pthread_mutex_unlock(&worker->inboxLock);
+
+	bool success = true;
+	for (size_t i = 0; i < receivedCount && success; i++) {
+		const struct OptimisticMessage * message = &received[i];
+		if (message->type == OPTIMISTIC_CANCEL) {
+			success = cancelMessage(worker, message);
+			continue;
+		}
+
+		if (worker->processedCount > 0 && worker->processed[worker->processedCount - 1].time >= message->time) {
+			success = rollback(worker, message->time);
+		}
+		success = success && pushInput(worker, *message);
+	}
+
+	return success;
+}
+
+// Releases what was processed before the global virtual time, it cannot be rolled back anymore
+static void collectFossils(struct OptimisticWorker * worker, double gvt) {
+	size_t committed = 0;
+	while (committed < worker->processedCount && worker->processed[committed].time < gvt) {
+		worker->statistics.events += worker->processed[committed].events;
+		worker->statistics.stripEvents += worker->processed[committed].stripEvents;
+		committed++;
+	}
+
+	if (committed == 0) {
+		return;
+	}
+
+	worker->committed = worker->processed[committed - 1].time;
+
+	const size_t undo = committed < worker->processedCount ? worker->processed[committed].undo : worker->undoCount;
+	const size_t sent = committed < worker->processedCount ? worker->processed[committed].sent : worker->sentCount;
+
+	memmove(worker->undo, worker->undo + undo, (worker->undoCount - undo) * sizeof(struct OptimisticUndo));
+	memmove(worker->sent, worker->sent + sent, (worker->sentCount - sent) * sizeof(struct OptimisticSent));
+	memmove(worker->processed, worker->processed + committed,
+	        (worker->processedCount - committed) * sizeof(struct OptimisticProcessed));
+
+	worker->undoCount -= undo;
+	worker->sentCount -= sent;
+	worker->processedCount -= committed;
+	for (size_t k = 0; k < worker->processedCount; k++) {
+		worker->processed[k].undo -= undo;
+		worker->processed[k].sent -= sent;
+	}
+}
+
+static double nextTime(const struct OptimisticWorker * worker) {
+	const double eventTime = worker->queueSize > 0 ? worker->nextTimes[worker->queue[0]] : INFINITY;
+	const double messageTime = worker->inputCount > 0 ? worker->inputs[0].time : INFINITY;
+	return fmin(eventTime, messageTime);
+}
+
+// What the worker could still send, pending anti-messages included
+static double reportTime(const struct OptimisticWorker * worker) {
+	const double pendingTime = worker->pendingStart < worker->pendingCount
+	                           ? worker->pending[worker->pendingStart].message.time : INFINITY;
+	return fmin(nextTime(worker), pendingTime);
+}
+
+// Reports to the round of the global virtual time if there is one, after taking in the messages sent before it
+static bool reportRound(struct OptimisticWorker * worker) {
+	struct OptimisticEngine * engine = worker->engine;
+
+	const cl_uint round = atomic_load(&engine->gvtStarted);
+	if (round == atomic_load(&engine->gvtFinished) || worker->reportedRound == round) {
+		return true;
+	}
+
+	if (!receiveMessages(worker)) {
+		return false;
+	}
+
+	pthread_mutex_lock(&engine->gvtLock);
+	const bool finished = reportLocked(engine, worker, round, reportTime(worker));
+	pthread_mutex_unlock(&engine->gvtLock);
+
+	if (finished) {
+		finishRound(engine);
+	}
+
+	return true;
+}
+
+// Nothing to do before the limit, waits for a message or for the global virtual time to move the limit. A round
+// started in the meantime gets the report, and a new one is started so the global virtual time can move
+static void waitIdle(struct OptimisticWorker * worker, double minimum) {
+	struct OptimisticEngine * engine = worker->engine;
+
+	pthread_mutex_lock(&worker->inboxLock);
+	if (worker->inboxCount > 0 || atomic_load(&engine->done)) {
+		pthread_mutex_unlock(&worker->inboxLock);
+		return;
+	}
+
+	pthread_mutex_lock(&engine->gvtLock);
+	const cl_uint round = atomic_load(&engine->gvtStarted);
+	const bool active = round != atomic_load(&engine->gvtFinished);
+	const bool finished = active && worker->reportedRound != round && reportLocked(engine, worker, round, minimum);
+	if (active && !finished) {
+		engine->gvtAgain = true;
+	}
+	pthread_mutex_unlock(&engine->gvtLock);
+
+	worker->idle = true;
+	worker->idleTime = minimum;
+	worker->woken = false;
+	pthread_mutex_unlock(&worker->inboxLock);
+
+	if (finished) {
+		finishRound(engine);
+	} else if (!active) {
+		startRound(engine);
+	}
+
+	pthread_mutex_lock(&worker->inboxLock);
+	while (worker->inboxCount == 0 && !worker->woken && !atomic_load(&engine->done)) {
+		pthread_cond_wait(&worker->inboxCondition, &worker->inboxLock);
+	}
+	worker->idle = false;
+	pthread_mutex_unlock(&worker->inboxLock);
+}
+
+static double threadTime() {
+	struct timespec now;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+	return (double) now.tv_sec + (double) now.tv_nsec * 1e-9;
+}
+
+static void * runWorker(void * argument) {
+	struct OptimisticWorker * worker = argument;
+	struct OptimisticEngine * engine = worker->engine;
+	const double start = threadTime();
+
+	while (!atomic_load(&engine->done)) {
+		if (!receiveMessages(worker)) {
+			fail(worker);
+			break;
+		}
+
+		if (atomic_load(&engine->gvtFinished) != worker->seenRound) {
+			pthread_mutex_lock(&engine->gvtLock);
+			worker->seenRound = atomic_load(&engine->gvtFinished);
+			worker->gvt = engine->gvt;
+			pthread_mutex_unlock(&engine->gvtLock);
+
+			collectFossils(worker, worker->gvt);
+		}
+
+		if (!reportRound(worker)) {
+			fail(worker);
+			break;
+		}
+
+		const double limit = fmin(engine->end, worker->gvt + engine->speculation);
+		const double next = nextTime(worker);
+		if (next >= limit) {
+			if (!cancelPending(worker, next)) {
+				fail(worker);
+				break;
+			}
+
+			waitIdle(worker, reportTime(worker));
+			continue;
+		}
+
+		// A message goes before an event at the same time
+		bool success;
+		if (worker->inputCount > 0 && worker->inputs[0].time == next) {
+			const struct OptimisticMessage message = worker->inputs[0];
+			removeInput(worker, 0);
+			success = processMessage(worker, message);
+		} else {
+			success = processEvent(worker, worker->queue[0]);
+		}
+
+		if (!success) {
+			fail(worker);
+			break;
+		}
+
+		if (++worker->sinceRound >= optimisticRoundInterval) {
+			worker->sinceRound = 0;
+			startRound(engine);
+		}
+	}
+
+	worker->cpuTime += threadTime() - start;
+	return nullptr;
+}
+
+struct OptimisticEngine initOptimisticEngine(const struct Particle * particles, cl_uint count, cl_float2 box,
+                                             cl_uint workers, double speculation) {
+	struct OptimisticEngine engine = {0};
+
+	engine.count = count;
+	engine.box = box;
+	engine.speculation = speculation;
+
+	// About one particle per cell, and at least a collision wide
+	const double side = fmax(2 * radius, sqrt((double) box.x * box.y / (count > 0 ? count : 1)));
+	engine.columns = box.x / side >= 1 ? (cl_uint) (box.x / side) : 1;
+	engine.rows = box.y / side >= 1 ? (cl_uint) (box.y / side) : 1;
+	engine.cellWidth = box.x / engine.columns;
+	engine.cellHeight = box.y / engine.rows;
+
+	engine.workers = workers == 0 ? 1 : workers;
+	if (engine.workers > engine.columns) {
+		engine.workers = engine.columns;
+	}
+
+	engine.columnStarts = calloc(engine.workers + 1, sizeof(cl_uint));
+	engine.columnOwners = calloc(engine.columns, sizeof(cl_uint));
+	engine.workerStates = calloc(engine.workers, sizeof(struct OptimisticWorker));
+	if (engine.columnStarts == nullptr || engine.columnOwners == nullptr || engine.workerStates == nullptr) {
+		printf("Error: Failed to allocate optimistic engine!\n");
+		engine.success = false;
+		return engine;
+	}
+
+	// Strips of the same number of columns, give or take one
+	for (cl_uint index = 0; index <= engine.workers; index++) {
+		engine.columnStarts[index] = (cl_uint) ((cl_ulong) engine.columns * index / engine.workers);
+	}
+	for (cl_uint index = 0; index < engine.workers; index++) {
+		for (cl_uint column = engine.columnStarts[index]; column < engine.columnStarts[index + 1]; column++) {
+			engine.columnOwners[column] = index;
+		}
+	}
+
+	const cl_uint cells = engine.columns * engine.rows;
+	for (cl_uint index = 0; index < engine.workers; index++) {
+		struct OptimisticWorker * worker = &engine.workerStates[index];
+		worker->engine = &engine;
+		worker->index = index;
+
+		pthread_mutex_init(&worker->inboxLock, nullptr);
+		pthread_cond_init(&worker->inboxCondition, nullptr);
+
+		worker->particles = calloc(count, sizeof(struct OptimisticParticle));
+		worker->cells = malloc(cells * sizeof(cl_int));
+		worker->nextTimes = calloc(count, sizeof(double));
+		worker->nextPartners = calloc(count, sizeof(cl_int));
+		worker->partnerVersions = calloc(count, sizeof(cl_uint));
+		worker->queue = calloc(count, sizeof(cl_uint));
+		worker->queuePositions = malloc(count * sizeof(cl_int));
+		worker->restored = calloc(count, sizeof(bool));
+		worker->restoredList = calloc(count, sizeof(cl_uint));
+		if (worker->particles == nullptr || worker->cells == nullptr || worker->nextTimes == nullptr
+		    || worker->nextPartners == nullptr || worker->partnerVersions == nullptr || worker->queue == nullptr
+		    || worker->queuePositions == nullptr || worker->restored == nullptr || worker->restoredList == nullptr) {
+			printf("Error: Failed to allocate optimistic engine!\n");
+			engine.success = false;
+			return engine;
+		}
+
+		for (cl_uint cell = 0; cell < cells; cell++) {
+			worker->cells[cell] = -1;
+		}
+		for (cl_uint i = 0; i < count; i++) {
+			worker->queuePositions[i] = -1;
+		}
+	}
+
+	// Every strip owns the particles of its columns and sees the ones in the columns next to it
+	for (cl_uint i = 0; i < count; i++) {
+		const double x = particles[i].position.x;
+		const double y = particles[i].position.y;
+		const cl_uint column = x <= 0 ? 0 : x / engine.cellWidth < engine.columns ? (cl_uint) (x / engine.cellWidth)
+		                                                                           : engine.columns - 1;
+		const cl_uint row = y <= 0 ? 0 : y / engine.cellHeight < engine.rows ? (cl_uint) (y / engine.cellHeight)
+		                                                                      : engine.rows - 1;
+		const cl_uint owner = engine.columnOwners[column];
+
+		struct OptimisticParticle particle = {
+			.segment = {
+				.time = 0,
+				.x = x,
+				.y = y,
+				.vx = particles[i].velocity.x,
+				.vy = particles[i].velocity.y,
+			},
+			.cell = row * engine.columns + column,
+		};
+
+		for (cl_uint index = 0; index < engine.workers; index++) {
+			struct OptimisticWorker * worker = &engine.workerStates[index];
+			particle.version = ++worker->versions;
+
+			if (index == owner) {
+				particle.state = OPTIMISTIC_OWNED;
+			} else if ((index + 1 == owner || owner + 1 == index) && column == borderColumn(&engine.workerStates[owner],
+			                                                                                  index)) {
+				particle.state = OPTIMISTIC_GHOST;
+			} else {
+				continue;
+			}
+
+			replaceParticle(worker, i, particle);
+		}
+	}
+
+	for (cl_uint index = 0; index < engine.workers; index++) {
+		struct OptimisticWorker * worker = &engine.workerStates[index];
+		for (cl_uint i = 0; i < count; i++) {
+			if (worker->particles[i].state == OPTIMISTIC_OWNED) {
+				computeNextEvent(worker, i);
+			}
+		}
+	}
+
+	engine.success = true;
+	return engine;
+}
+
+int advanceOptimisticEngine(struct OptimisticEngine * engine, double time) {
+	if (!engine->success) {
+		return EXIT_FAILURE;
+	}
+
+	if (time <= engine->end) {
+		return EXIT_SUCCESS;
+	}
+	engine->end = time;
+
+	pthread_mutex_init(&engine->gvtLock, nullptr);
+	atomic_store(&engine->gvtStarted, 0);
+	atomic_store(&engine->gvtFinished, 0);
+	atomic_store(&engine->done, false);
+	engine->gvtAgain = false;
+
+	// The workers point back to the engine, which may have been moved since the last call
+	for (cl_uint index = 0; index < engine->workers; index++) {
+		struct OptimisticWorker * worker = &engine->workerStates[index];
+		worker->engine = engine;
+		worker->gvt = engine->gvt;
+		worker->reportedRound = 0;
+		worker->seenRound = 0;
+		worker->sendMinimum = INFINITY;
+		worker->idle = false;
+		worker->woken = false;
+		worker->success = true;
+	}
+
+	// The first worker is this thread
+	cl_uint threads = 1;
+	for (; threads < engine->workers; threads++) {
+		struct OptimisticWorker * worker = &engine->workerStates[threads];
+		if (pthread_create(&worker->thread, nullptr, runWorker, worker) != 0) {
+			printf("Error: Failed to create optimistic worker %u!\n", threads);
+			fail(worker);
+			break;
+		}
+	}
+
+	if (threads == engine->workers) {
+		runWorker(&engine->workerStates[0]);
+	}
+
+	for (cl_uint index = 1; index < threads; index++) {
+		pthread_join(engine->workerStates[index].thread, nullptr);
+	}
+
+	pthread_mutex_destroy(&engine->gvtLock);
+
+	// Everything before the end is committed
+	const cl_ulong gvtRounds = engine->statistics.gvtRounds;
+	engine->statistics = (struct OptimisticStatistics) { .gvtRounds = gvtRounds };
+	for (cl_uint index = 0; index < engine->workers; index++) {
+		struct OptimisticWorker * worker = &engine->workerStates[index];
+		collectFossils(worker, engine->gvt);
+		engine->success &= worker->success;
+
+		engine->statistics.events += worker->statistics.events;
+		engine->statistics.stripEvents += worker->statistics.stripEvents;
+		engine->statistics.rolledBackEvents += worker->statistics.rolledBackEvents;
+		engine->statistics.rollbacks += worker->statistics.rollbacks;
+		engine->statistics.messages += worker->statistics.messages;
+		engine->statistics.antiMessages += worker->statistics.antiMessages;
+		engine->statistics.keptMessages += worker->statistics.keptMessages;
+		engine->statistics.busiestWorkerTime = fmax(engine->statistics.busiestWorkerTime, worker->cpuTime);
+	}
+
+	if (!engine->success) {
+		printf("Error: Failed to advance optimistic engine!\n");
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+void getOptimisticParticles(const struct OptimisticEngine * engine, struct Particle * particles) {
+	for (cl_uint index = 0; index < engine->workers; index++) {
+		const struct OptimisticWorker * worker = &engine->workerStates[index];
+		for (cl_uint i = 0; i < engine->count; i++) {
+			if (worker->particles[i].state != OPTIMISTIC_OWNED) {
+				continue;
+			}
+
+			const struct OptimisticSegment particle = moveSegment(&worker->particles[i].segment, engine->end);
+			particles[i].position = (cl_float2) { .x = (cl_float) particle.x, .y = (cl_float) particle.y };
+			particles[i].velocity = (cl_float2) { .x = (cl_float) particle.vx, .y = (cl_float) particle.vy };
+		}
+	}
+}
+
+void releaseOptimisticEngine(struct OptimisticEngine engine) {
+	if (engine.workerStates != nullptr) {
+		for (cl_uint index = 0; index < engine.workers; index++) {
+			struct OptimisticWorker * worker = &engine.workerStates[index];
+
+			pthread_mutex_destroy(&worker->inboxLock);
+			pthread_cond_destroy(&worker->inboxCondition);
+
+			free(worker->particles);
+			free(worker->cells);
+			free(worker->nextTimes);
+			free(worker->nextPartners);
+			free(worker->partnerVersions);
+			free(worker->queue);
+			free(worker->queuePositions);
+			free(worker->restored);
+			free(worker->restoredList);
+			free(worker->inputs);
+			free(worker->processed);
+			free(worker->undo);
+			free(worker->sent);
+			free(worker->pending);
+			free(worker->inbox);
+			free(worker->received);
+		}
+	}
+
+	free(engine.columnStarts);
+	free(engine.columnOwners);
+	free(engine.workerStates);
+}
@@ -0,0 +1,220 @@
+#ifndef COLLISIONBASEDGASSIMULATOR_OPTIMISTIC_H
+#define COLLISIONBASEDGASSIMULATOR_OPTIMISTIC_H
+
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include <CL/cl.h>
+
+#include "datatypes.h"
+
+// Time Warp simulation of a single system on the host. The box is divided in cells at least a collision wide, and
+// the columns of cells in vertical strips, one logical process and worker thread per strip. A strip owns the
+// particles whose cell is in it and keeps a copy, a ghost, of the particles in the columns next to it, which is all it
+// needs to find the next event of its own particles. Every strip takes its events from its own priority queue and
+// runs ahead on its own, telling its neighbors with a message whenever a particle they see changes. A message older
+// than the strip that receives it, a straggler, rolls back only that strip to the state saved by its events, and
+// anti-messages cancel what it sent in the undone events. The global virtual time is the minimum over the next event
+// of every strip and the messages in flight, what is before it is committed and its saved state released. No strip
+// runs further than speculation past it
+//
+// Every strip does its collisions from the same segments with the same arithmetic, so any number of workers gives the
+// same results. OptimisticBenchmark checks it against a single worker
+
+// A particle moves in a straight line from time on
+struct OptimisticSegment {
+	double time;
+	double x, y;
+	double vx, vy;
+};
+
+enum OptimisticState {
+	OPTIMISTIC_ABSENT = 0,
+	OPTIMISTIC_OWNED,
+	OPTIMISTIC_GHOST,
+};
+
+// A particle as a strip sees it
+struct OptimisticParticle {
+	struct OptimisticSegment segment;
+	cl_uint cell;
+	cl_uint version; // Changes with the segment and is never used again, so a prediction made before is recognized
+	cl_int previous; // In the list of the cell, -1 at the ends
+	cl_int next;
+	cl_uint state; // OptimisticState
+};
+
+enum OptimisticMessageType {
+	OPTIMISTIC_UPDATE = 0, // The ghost is set to the segment and cell, added if the receiver did not have it
+	OPTIMISTIC_REMOVE, // The particle left the column next to the receiver
+	OPTIMISTIC_MIGRATE, // The particle crossed into the receiver, which owns it from then on
+	OPTIMISTIC_CANCEL, // Anti-message of the message with the same sender and serial
+};
+
+struct OptimisticMessage {
+	double time;
+	cl_ulong serial; // Of the sender, never used again
+	cl_uint sender;
+	cl_uint type; // OptimisticMessageType
+	cl_uint particle;
+	cl_uint cell;
+	struct OptimisticSegment segment;
+};
+
+// State of a particle before an event changed it
+struct OptimisticUndo {
+	cl_uint particle;
+	struct OptimisticParticle state;
+};
+
+// Message sent by an event that was not committed yet, to cancel it if the event is rolled back
+struct OptimisticSent {
+	cl_uint receiver;
+	struct OptimisticMessage message;
+};
+
+// Event or message processed since the global virtual time, and where its saved states and sent messages start
+struct OptimisticProcessed {
+	double time;
+	size_t undo;
+	size_t sent;
+	cl_uint events; // Collisions, a collision between strips is counted by the first of the two
+	cl_uint stripEvents;
+	bool isMessage;
+	struct OptimisticMessage message;
+};
+
+struct OptimisticStatistics {
+	cl_ulong events; // Committed collisions, walls included
+	cl_ulong stripEvents; // Committed collisions between particles of different strips
+	cl_ulong rolledBackEvents; // Collisions processed and then undone
+	cl_ulong rollbacks; // Stragglers and anti-messages that rolled a strip back
+	cl_ulong messages; // Between strips, anti-messages included
+	cl_ulong antiMessages;
+	cl_ulong keptMessages; // Sent again by events done again after a rollback, so not cancelled
+	cl_ulong gvtRounds;
+	double busiestWorkerTime; // CPU seconds of the worker that used the most
+};
+
+struct OptimisticWorker {
+	struct OptimisticEngine * engine;
+	cl_uint index;
+	pthread_t thread;
+
+	struct OptimisticParticle * particles; // Every particle by id, most of them absent
+	cl_int * cells; // First particle of every cell, -1 when empty
+
+	// Next event of every owned particle, a partner or one of the walls or cell borders, and the queue over them
+	double * nextTimes;
+	cl_int * nextPartners;
+	cl_uint * partnerVersions;
+	cl_uint * queue;
+	cl_int * queuePositions; // -1 when not in the queue
+	cl_uint queueSize;
+	cl_uint versions;
+
+	// Received and not processed yet, a heap by time
+	struct OptimisticMessage * inputs;
+	size_t inputCount;
+	size_t inputCapacity;
+
+	// Since the global virtual time
+	struct OptimisticProcessed * processed;
+	size_t processedCount;
+	size_t processedCapacity;
+	struct OptimisticUndo * undo;
+	size_t undoCount;
+	size_t undoCapacity;
+	struct OptimisticSent * sent;
+	size_t sentCount;
+	size_t sentCapacity;
+	cl_ulong serials;
+
+	// Sent by rolled back events, by time. They are cancelled lazily: an event done again that sends the same message
+	// keeps it, the ones still here when the strip gets past their time get their anti-message
+	struct OptimisticSent * pending;
+	size_t pendingStart;
+	size_t pendingCount;
+	size_t pendingCapacity;
+
+	double now; // Time of the last processed event or message
+	double committed; // Same, of the last one committed
+	double gvt; // Last global virtual time seen
+
+	// Particles restored by a rollback
+	bool * restored;
+	cl_uint * restoredList;
+
+	// Messages from the neighbors, under inboxLock. received is the inbox being processed
+	pthread_mutex_t inboxLock;
+	pthread_cond_t inboxCondition;
+	struct OptimisticMessage * inbox;
+	size_t inboxCount;
+	size_t inboxCapacity;
+	struct OptimisticMessage * received;
+	size_t receivedCapacity;
+	bool idle; // Waiting with nothing to do before idleTime
+	double idleTime;
+	bool woken;
+
+	// Under the gvtLock of the engine
+	cl_uint reportedRound;
+	double sendMinimum; // Of the messages sent since the round started and before reporting
+	cl_uint seenRound;
+	cl_uint sinceRound; // Events and messages processed since this worker started a round
+
+	struct OptimisticStatistics statistics;
+	double cpuTime;
+	bool success;
+};
+
+struct OptimisticEngine {
+	cl_uint count;
+	cl_uint workers;
+	cl_float2 box;
+	double speculation;
+
+	cl_uint columns;
+	cl_uint rows;
+	double cellWidth;
+	double cellHeight;
+	cl_uint * columnStarts; // First column of every strip, and columns at the end
+	cl_uint * columnOwners;
+
+	struct OptimisticWorker * workerStates;
+
+	double end; // Time the last call advanced to
+	double gvt; // Global virtual time, under gvtLock
+
+	// Rounds of the global virtual time, the last worker to report one computes it
+	pthread_mutex_t gvtLock;
+	atomic_uint gvtStarted;
+	atomic_uint gvtFinished;
+	cl_uint gvtRemaining;
+	double gvtMinimum;
+	bool gvtAgain; // A worker went idle during the round and needs another one
+	atomic_bool done;
+
+	struct OptimisticStatistics statistics;
+
+	bool success;
+};
+
+// Default of how far past the global virtual time the strips may run
+static const double optimisticSpeculation = 1;
+// Events and messages a worker processes between rounds of the global virtual time it starts
+static const cl_uint optimisticRoundInterval = 512;
+
+// workers is the number of threads and strips, at most the number of columns of cells
+struct OptimisticEngine initOptimisticEngine(const struct Particle * particles, cl_uint count, cl_float2 box,
+                                             cl_uint workers, double speculation);
+
+int advanceOptimisticEngine(struct OptimisticEngine * engine, double time);
+
+// particles must hold count particles, at the time of the last call
+void getOptimisticParticles(const struct OptimisticEngine * engine, struct Particle * particles);
+
+void releaseOptimisticEngine(struct OptimisticEngine engine);
+
+#endif //COLLISIONBASEDGASSIMULATOR_OPTIMISTIC_H
@@ -0,0 +1,145 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#define nullptr NULL
+
+#include "optimistic.h"
+
+static long double getTime() {
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	return (long double) now.tv_sec + (long double) now.tv_nsec * 1e-9;
+}
+
+// Particles on a grid with some space between them, random directions of the same speed as the simulator
+static void generateParticles(struct Particle * particles, cl_uint count, cl_float2 * box) {
+	const cl_uint columns = (cl_uint) ceil(sqrt((double) count));
+	const cl_float spacing = 6 * radius;
+
+	*box = (cl_float2) { .x = (cl_float) columns * spacing, .y = (cl_float) ((count + columns - 1) / columns) * spacing };
+
+	srand(22);
+	for (cl_uint i = 0; i < count; i++) {
+		const double angle = 2 * M_PI * rand() / RAND_MAX;
+		particles[i].position = (cl_float2) { .x = ((cl_float) (i % columns) + 0.5f) * spacing,
+		                                      .y = ((cl_float) (i / columns) + 0.5f) * spacing };
+		particles[i].velocity = (cl_float2) { .x = (cl_float) (20 * cos(angle)), .y = (cl_float) (20 * sin(angle)) };
+	}
+}
+
+static double kineticEnergy(const struct Particle * particles, cl_uint count) {
+	double energy = 0;
+	for (cl_uint i = 0; i < count; i++) {
+		energy += particles[i].velocity.x * particles[i].velocity.x + particles[i].velocity.y * particles[i].velocity.y;
+	}
+	return energy / 2;
+}
+
+// Largest difference in any coordinate of the position or the velocity of a particle between two runs
+static double maxDifference(const struct Particle * a, const struct Particle * b, cl_uint count) {
+	double difference = 0;
+	for (cl_uint i = 0; i < count; i++) {
+		difference = fmax(difference, fabs(a[i].position.x - b[i].position.x));
+		difference = fmax(difference, fabs(a[i].position.y - b[i].position.y));
+		difference = fmax(difference, fabs(a[i].velocity.x - b[i].velocity.x));
+		difference = fmax(difference, fabs(a[i].velocity.y - b[i].velocity.y));
+	}
+	return difference;
+}
+
+// Runs the engine with the given workers until time
+static int run(const struct Particle * particles, struct Particle * result, cl_uint count, cl_float2 box,
+               cl_uint * workers, double speculation, double time, long double * elapsed,
+               struct OptimisticStatistics * statistics) {
+	struct OptimisticEngine engine = initOptimisticEngine(particles, count, box, *workers, speculation);
+	if (!engine.success) {
+		releaseOptimisticEngine(engine);
+		return EXIT_FAILURE;
+	}
+
+	const long double start = getTime();
+	if (advanceOptimisticEngine(&engine, time) != EXIT_SUCCESS) {
+		releaseOptimisticEngine(engine);
+		return EXIT_FAILURE;
+	}
+	*elapsed = getTime() - start;
+
+	getOptimisticParticles(&engine, result);
+	*statistics = engine.statistics;
+	*workers = engine.workers;
+
+	releaseOptimisticEngine(engine);
+	return EXIT_SUCCESS;
+}
+
+// Usage: OptimisticBenchmark [particles] [time] [workers] [speculation] [tolerance]
+// A single worker never rolls back, the run with workers must end in the same state within tolerance. The speedup is
+// also estimated from the CPU time of the busiest worker, which is what it would be on as many cores if the workers
+// never waited for each other
+int main(int argc, char ** argv) {
+	const cl_uint count = argc > 1 ? (cl_uint) strtoul(argv[1], nullptr, 10) : 4096;
+	const double time = argc > 2 ? strtod(argv[2], nullptr) : 50;
+	cl_uint workers = argc > 3 ? (cl_uint) strtoul(argv[3], nullptr, 10) : (cl_uint) sysconf(_SC_NPROCESSORS_ONLN);
+	const double speculation = argc > 4 ? strtod(argv[4], nullptr) : optimisticSpeculation;
+	const double tolerance = argc > 5 ? strtod(argv[5], nullptr) : 1e-6;
+
+	struct Particle * particles = calloc(count, sizeof(struct Particle));
+	struct Particle * sequentialResult = calloc(count, sizeof(struct Particle));
+	struct Particle * parallelResult = calloc(count, sizeof(struct Particle));
+	if (particles == nullptr || sequentialResult == nullptr || parallelResult == nullptr) {
+		free(particles);
+		free(sequentialResult);
+		free(parallelResult);
+		return EXIT_FAILURE;
+	}
+
+	cl_float2 box;
+	generateParticles(particles, count, &box);
+
+	long double sequentialTime, parallelTime;
+	struct OptimisticStatistics sequential, parallel;
+	cl_uint single = 1;
+	if (run(particles, sequentialResult, count, box, &single, speculation, time, &sequentialTime, &sequential)
+	    != EXIT_SUCCESS
+	    || run(particles, parallelResult, count, box, &workers, speculation, time, &parallelTime, &parallel)
+	       != EXIT_SUCCESS) {
+		free(particles);
+		free(sequentialResult);
+		free(parallelResult);
+		return EXIT_FAILURE;
+	}
+
+	const double initialEnergy = kineticEnergy(particles, count);
+
+	printf("%u particles in %.0f x %.0f until %.2f, speculation %.2f\n", count, box.x, box.y, time, speculation);
+	printf("1 worker: %.3Lfs, %lu events\n", sequentialTime, (unsigned long) sequential.events);
+	printf("%u workers: %.3Lfs (%.2fx), %lu events, %lu between strips\n", workers, parallelTime,
+	       (double) (sequentialTime / parallelTime), (unsigned long) parallel.events,
+	       (unsigned long) parallel.stripEvents);
+	printf("busiest worker: %.3fs of CPU time, %.2fx estimated on %u cores\n", parallel.busiestWorkerTime,
+	       sequential.busiestWorkerTime / parallel.busiestWorkerTime, workers);
+	printf("rollbacks: %lu, %lu events undone (%.1f%% of the work)\n", (unsigned long) parallel.rollbacks,
+	       (unsigned long) parallel.rolledBackEvents,
+	       100.0 * (double) parallel.rolledBackEvents / (double) (parallel.events + parallel.rolledBackEvents + 1));
+	printf("messages: %lu, %lu of them anti-messages, %lu kept after a rollback, %lu rounds of the global virtual "
+	       "time\n", (unsigned long) parallel.messages, (unsigned long) parallel.antiMessages,
+	       (unsigned long) parallel.keptMessages, (unsigned long) parallel.gvtRounds);
+	printf("energy error: %.2e\n", (kineticEnergy(parallelResult, count) - initialEnergy) / initialEnergy);
+
+	const double difference = maxDifference(sequentialResult, parallelResult, count);
+	printf("max difference with 1 worker: %.2e (tolerance %.2e)\n", difference, tolerance);
+
+	free(particles);
+	free(sequentialResult);
+	free(parallelResult);
+
+	if (!(difference <= tolerance)) {
+		printf("Error: %u workers do not match 1 worker!\n", workers);
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
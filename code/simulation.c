@@ -0,0 +1,2437 @@
+#include "simulation.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <math.h>
+#include <float.h>
+#include <time.h>
+#include <string.h>
+
+#define nullptr NULL
+
+#include "configuration.h"
+#include "optimistic.h"
+#include "simulator.h"
+#include "trace.h"
+#include "trajectory.h"
+
+static cl_float2 generatePosition() {
+	const cl_float x = radius + fmodf((cl_float) rand(), (cl_float) width - radius * 2);
+	const cl_float y = radius + fmodf((cl_float) rand(), (cl_float) height - radius * 2);
+
+	return (cl_float2) { .x = x, .y = y };
+}
+
+static cl_float2 generateVelocity() {
+	const cl_float length = 20;
+
+	const cl_float x = 0.1f + fmodf((cl_float) rand(), 10.0f);
+	const cl_float y = 0.1f + fmodf((cl_float) rand(), 10.0f);
+
+	const cl_float randomLength = hypotf(x, y);
+
+	return (cl_float2) { .x = x / randomLength * length, .y = y / randomLength * length };
+}
+
+struct ClState {
+	cl_platform_id platform;
+	cl_device_id device_id;
+	cl_context context;
+	cl_command_queue commands;
+	cl_program program;
+
+	bool hostUnifiedMemory; // Host and device share memory, buffers can be accessed in place by the host
+	cl_uint pairVectorWidth; // Partners every work item of the pair kernels tests at once, PAIR_VECTOR_WIDTH
+
+	bool success;
+};
+
+static struct ClState initClState(bool gpu) {
+	struct ClState clState = {0};
+
+	{ // Get available platforms
+		cl_uint numberOfPlatforms;
+		const cl_int err = clGetPlatformIDs(1, &clState.platform, &numberOfPlatforms);
+		if (err != CL_SUCCESS) {
+			printf("Error: Failed to create get a platform! %d\n", err);
+			clState.success = false;
+			return clState;
+		}
+	}
+
+	{ // Connect to a compute device
+		const cl_int err = clGetDeviceIDs(clState.platform, gpu ? CL_DEVICE_TYPE_GPU : CL_DEVICE_TYPE_CPU, 1, &clState.device_id, nullptr);
+		if (err != CL_SUCCESS) {
+			printf("Error: Failed to create a device group! %d\n", err);
+			clState.success = false;
+			return clState;
+		}
+	}
+
+	{ // Check if the device shares memory with the host
+		cl_bool hostUnifiedMemory;
+		const cl_int err = clGetDeviceInfo(clState.device_id, CL_DEVICE_HOST_UNIFIED_MEMORY, sizeof(hostUnifiedMemory),
+		                                   &hostUnifiedMemory, nullptr);
+		clState.hostUnifiedMemory = err == CL_SUCCESS && hostUnifiedMemory == CL_TRUE;
+	}
+
+	{ // Pick the vector width of the pair kernels, the vector code has no per test trace
+		cl_uint preferredWidth = pairVectorWidth;
+		if (preferredWidth == 0) {
+			const cl_int err = clGetDeviceInfo(clState.device_id, CL_DEVICE_PREFERRED_VECTOR_WIDTH_FLOAT,
+			                                   sizeof(preferredWidth), &preferredWidth, nullptr);
+			if (err != CL_SUCCESS) {
+				preferredWidth = 1;
+			}
+		}
+
+		clState.pairVectorWidth = 1;
+		while (clState.pairVectorWidth * 2 <= preferredWidth && clState.pairVectorWidth < 16) {
+			clState.pairVectorWidth *= 2;
+		}
+
+		if (traceLevel >= TRACE_LEVEL_TESTS) {
+			clState.pairVectorWidth = 1;
+		}
+	}
+
+	{ // Create a compute context
+		cl_int err;
+		clState.context = clCreateContext(nullptr, 1, &clState.device_id, nullptr, NULL, &err);
+		if (err != CL_SUCCESS) {
+			printf("Error: Failed to create a compute context! %d\n", err);
+			clState.success = false;
+			return clState;
+		}
+	}
+
+	{ // Create a command commands
+		cl_int err;
+		clState.commands = clCreateCommandQueueWithProperties(clState.context, clState.device_id, nullptr, &err);
+		if (err != CL_SUCCESS) {
+			printf("Error: Failed to create a command commands! %d\n", err);
+			clState.success = false;
+			return clState;
+		}
+	}
+
+	{ // Create the compute program from the source buffer
+		cl_int err;
+
+		char* sources[] = { (char*) simulatorKernels, nullptr};
+		clState.program = clCreateProgramWithSource(clState.context, 1, (const char **) sources, nullptr, &err);
+		if (err != CL_SUCCESS) {
+			printf("Error: Failed to create compute program! %d\n", err);
+			clState.success = false;
+			return clState;
+		}
+	}
+
+	{ // Build the program executable
+		char options[256];
+		snprintf(options, sizeof(options), "-DTRACE_LEVEL=%u -DTRACE_CAPACITY=%u -DPAIR_VECTOR_WIDTH=%u", traceLevel,
+		         traceCapacity, clState.pairVectorWidth);
+
+		cl_int err = clBuildProgram(clState.program, 0, nullptr, options, nullptr, NULL);
+		if (err != CL_SUCCESS) {
+			size_t len;
+			char buffer[100*1024];
+
+			printf("Error: Failed to build program executable! %d\n", err);
+			clGetProgramBuildInfo(clState.program, clState.device_id, CL_PROGRAM_BUILD_LOG, sizeof(buffer), buffer, &len);
+			printf("%s\n", buffer);
+			clState.success = false;
+			return clState;
+		}
+	}
+
+	clState.success = true;
+	return clState;
+}
+
+// Also releases a state that failed to initialize, whatever was not created is nullptr
+static void releaseClState(struct ClState clState) {
+	if (clState.program != nullptr) {
+		clReleaseProgram(clState.program);
+	}
+	if (clState.commands != nullptr) {
+		clReleaseCommandQueue(clState.commands);
+	}
+	if (clState.context != nullptr) {
+		clReleaseContext(clState.context);
+	}
+}
+
+struct ClSimulationKernel {
+	cl_kernel calculateIntersectionTimeKernel;
+	cl_kernel calculateIntersectionBorderTimeKernel;
+	cl_kernel findMinKernel;
+	cl_kernel advanceSimulationKernel;
+	cl_kernel calculateMortonCodesKernel;
+	cl_kernel radixCountKernel;
+	cl_kernel radixScanKernel;
+	cl_kernel radixScatterKernel;
+	cl_kernel reorderParticlesKernel;
+	cl_kernel buildNeighborListsKernel;
+	cl_kernel calculateNeighborIntersectionTimeKernel;
+	cl_kernel calculateFusedIntersectionTimeKernel;
+	cl_kernel findMinFusedKernel;
+	cl_kernel simulatePersistentKernel;
+	cl_kernel countCandidatesKernel;
+	cl_kernel scanCandidatesKernel;
+	cl_kernel compactCandidatesKernel;
+
+	cl_mem particlesInput;
+	cl_mem particlesOutput;
+	// The pair times are reduced as they are computed instead of going through the matrix, see allocatePairTimes
+	bool fused;
+	cl_mem intersectionTimes; // nullptr when fused
+	cl_mem fusedWinners; // Only when fused, one per work group of every system
+	cl_uint fusedGroups;
+	// Only with the matrix and compactCandidates, room for candidateCapacity candidates of every system of which the
+	// first candidateCounts are used, and the counts of the rows and of their work groups
+	cl_mem candidates;
+	cl_mem candidateCounts;
+	cl_mem candidateRowCounts;
+	cl_mem candidateGroupCounts;
+	cl_uint candidateCapacity;
+	cl_uint candidateGroups;
+	cl_mem candidateCounters;
+	cl_mem collidedParticles;
+	cl_mem minimumTime;
+	cl_mem horizons;
+	cl_mem outcomeCounters;
+	cl_mem eventRecords; // One per system, what happened in the last step
+	cl_mem eventCounts; // Steps that advanced each system, cleared by the host
+
+	// External id of the particle in every slot of particlesInput, the reorder permutes both together
+	cl_mem particleIds;
+	cl_mem particleIdsOutput;
+	// Ping pong buffers of the radix sort, Morton codes and the slots they came from
+	cl_mem mortonKeys[2];
+	cl_mem mortonValues[2];
+	cl_mem radixHistograms;
+
+	// Neighbor lists, used when skin is larger than 0
+	cl_mem neighbors;
+	cl_mem neighborCounts;
+	cl_mem displacements; // Path length of every particle since its list was built
+	cl_mem rebuildFlags; // Set by findMin, or by the host, when the lists of a system have to be built again
+	cl_mem neighborCounters;
+	cl_float skin;
+
+	// Timestep and event record of every step of a launch of simulatePersistent, for every system, only allocated
+	// while persistentEvents is larger than 0
+	cl_mem persistentTimesteps;
+	cl_mem persistentEventRecords;
+	cl_uint persistentEvents;
+
+	// Only allocated when tracing is enabled
+	cl_mem traceEvents;
+	cl_mem traceCursor;
+
+	// The particle buffers are allocated in host accessible memory and mapped instead of copied
+	bool zeroCopy;
+	// particlesInput mapped for reading, it has to be unmapped before the next event
+	struct Particle * mappedParticles;
+	cl_mem mappedBuffer;
+
+	// Independent systems stored back to back in every buffer
+	cl_uint systems;
+
+	bool success;
+};
+
+static void releaseKernel(cl_kernel kernel) {
+	if (kernel != nullptr) {
+		clReleaseKernel(kernel);
+	}
+}
+
+static void releaseMemObject(cl_mem memObject) {
+	if (memObject != nullptr) {
+		clReleaseMemObject(memObject);
+	}
+}
+
+// Also releases a partially created struct, whatever was not created is nullptr
+static void releaseClSimulationKernel(struct ClSimulationKernel clSimulationKernel) {
+	releaseKernel(clSimulationKernel.calculateIntersectionTimeKernel);
+	releaseKernel(clSimulationKernel.calculateIntersectionBorderTimeKernel);
+	releaseKernel(clSimulationKernel.findMinKernel);
+	releaseKernel(clSimulationKernel.advanceSimulationKernel);
+	releaseKernel(clSimulationKernel.calculateMortonCodesKernel);
+	releaseKernel(clSimulationKernel.radixCountKernel);
+	releaseKernel(clSimulationKernel.radixScanKernel);
+	releaseKernel(clSimulationKernel.radixScatterKernel);
+	releaseKernel(clSimulationKernel.reorderParticlesKernel);
+	releaseKernel(clSimulationKernel.buildNeighborListsKernel);
+	releaseKernel(clSimulationKernel.calculateNeighborIntersectionTimeKernel);
+	releaseKernel(clSimulationKernel.calculateFusedIntersectionTimeKernel);
+	releaseKernel(clSimulationKernel.findMinFusedKernel);
+	releaseKernel(clSimulationKernel.simulatePersistentKernel);
+	releaseKernel(clSimulationKernel.countCandidatesKernel);
+	releaseKernel(clSimulationKernel.scanCandidatesKernel);
+	releaseKernel(clSimulationKernel.compactCandidatesKernel);
+
+	releaseMemObject(clSimulationKernel.particlesInput);
+	releaseMemObject(clSimulationKernel.particlesOutput);
+	releaseMemObject(clSimulationKernel.fusedWinners);
+	releaseMemObject(clSimulationKernel.intersectionTimes);
+	releaseMemObject(clSimulationKernel.candidates);
+	releaseMemObject(clSimulationKernel.candidateCounts);
+	releaseMemObject(clSimulationKernel.candidateRowCounts);
+	releaseMemObject(clSimulationKernel.candidateGroupCounts);
+	releaseMemObject(clSimulationKernel.candidateCounters);
+	releaseMemObject(clSimulationKernel.collidedParticles);
+	releaseMemObject(clSimulationKernel.minimumTime);
+	releaseMemObject(clSimulationKernel.horizons);
+	releaseMemObject(clSimulationKernel.outcomeCounters);
+	releaseMemObject(clSimulationKernel.eventRecords);
+	releaseMemObject(clSimulationKernel.eventCounts);
+	releaseMemObject(clSimulationKernel.particleIds);
+	releaseMemObject(clSimulationKernel.particleIdsOutput);
+	for (uint k = 0; k < 2; k++) {
+		releaseMemObject(clSimulationKernel.mortonKeys[k]);
+		releaseMemObject(clSimulationKernel.mortonValues[k]);
+	}
+	releaseMemObject(clSimulationKernel.radixHistograms);
+	releaseMemObject(clSimulationKernel.neighbors);
+	releaseMemObject(clSimulationKernel.neighborCounts);
+	releaseMemObject(clSimulationKernel.displacements);
+	releaseMemObject(clSimulationKernel.rebuildFlags);
+	releaseMemObject(clSimulationKernel.neighborCounters);
+	releaseMemObject(clSimulationKernel.persistentTimesteps);
+	releaseMemObject(clSimulationKernel.persistentEventRecords);
+	releaseMemObject(clSimulationKernel.traceEvents);
+	releaseMemObject(clSimulationKernel.traceCursor);
+}
+
+// Does nothing once err is set, so the kernels can be created one after the other and checked once
+static cl_kernel createKernel(cl_program program, const char * name, cl_int * err) {
+	if (*err != CL_SUCCESS) {
+		return nullptr;
+	}
+
+	const cl_kernel kernel = clCreateKernel(program, name, err);
+	if (*err != CL_SUCCESS) {
+		printf("Error: Failed to create compute kernel %s! %d\n", name, *err);
+		return nullptr;
+	}
+
+	return kernel;
+}
+
+// Buffers of the pair times of clSimulationKernel->fused, the per work group winners or the matrix and its candidate
+// lists, the ones of the other choice are released
+static int allocatePairTimes(struct ClState clState, struct ClSimulationKernel * clSimulationKernel) {
+	const cl_uint systems = clSimulationKernel->systems;
+
+	cl_mem * const pairTimeBuffers[] = {
+		&clSimulationKernel->fusedWinners, &clSimulationKernel->intersectionTimes, &clSimulationKernel->candidates,
+		&clSimulationKernel->candidateCounts, &clSimulationKernel->candidateRowCounts,
+		&clSimulationKernel->candidateGroupCounts,
+	};
+	for (size_t k = 0; k < sizeof(pairTimeBuffers) / sizeof(pairTimeBuffers[0]); k++) {
+		releaseMemObject(*pairTimeBuffers[k]);
+		*pairTimeBuffers[k] = nullptr;
+	}
+
+	if (clSimulationKernel->fused) { // Create the per work group winners in device memory, there is no matrix
+		clSimulationKernel->fusedGroups = (numberParticles + fusedGroupSize - 1) / fusedGroupSize;
+
+		cl_int err;
+		clSimulationKernel->fusedWinners = clCreateBuffer(clState.context, CL_MEM_READ_WRITE,
+		                                                  sizeof(struct FusedWinner) * clSimulationKernel->fusedGroups
+		                                                  * systems, nullptr, &err);
+		if (err != CL_SUCCESS) {
+			printf("Error: Failed to allocate device memory! %d\n", err);
+			return EXIT_FAILURE;
+		}
+	} else { // Create the output array in device memory for our calculation
+		cl_int err;
+		clSimulationKernel->intersectionTimes = clCreateBuffer(clState.context, CL_MEM_READ_WRITE,
+		                                                       sizeof(Time) * (numberParticles * numberParticles) * systems,
+															   nullptr, &err);
+		if (err != CL_SUCCESS) {
+			printf("Error: Failed to allocate device memory! %d\n", err);
+			return EXIT_FAILURE;
+		}
+
+		// The kernels write every entry findMin reads on every step, this only avoids reading garbage
+		const Time infinity = CL_INFINITY;
+		err = clEnqueueFillBuffer(clState.commands, clSimulationKernel->intersectionTimes, &infinity, sizeof(infinity),
+		                          0, sizeof(Time) * (numberParticles * numberParticles) * systems, 0, nullptr, nullptr);
+		if (err != CL_SUCCESS) {
+			printf("Error: Failed to clear intersection times! %d\n", err);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (!clSimulationKernel->fused && compactCandidates) { // Create the candidate lists in device memory
+		// A bounded list, a system with more candidates walks the matrix instead
+		const cl_uint triangle = numberParticles * (numberParticles + 1) / 2;
+		clSimulationKernel->candidateCapacity = candidatesPerParticle * numberParticles < triangle ?
+			candidatesPerParticle * numberParticles : triangle;
+		clSimulationKernel->candidateGroups = (numberParticles + candidateGroupSize - 1) / candidateGroupSize;
+
+		cl_int err;
+		clSimulationKernel->candidates = clCreateBuffer(clState.context, CL_MEM_READ_WRITE,
+		                                                sizeof(struct FusedWinner) * clSimulationKernel->candidateCapacity
+		                                                * systems, nullptr, &err);
+		if (err != CL_SUCCESS) {
+			printf("Error: Failed to allocate device memory! %d\n", err);
+			return EXIT_FAILURE;
+		}
+
+		clSimulationKernel->candidateCounts = clCreateBuffer(clState.context, CL_MEM_READ_WRITE,
+		                                                     sizeof(cl_uint) * systems, nullptr, &err);
+		if (err != CL_SUCCESS) {
+			printf("Error: Failed to allocate device memory! %d\n", err);
+			return EXIT_FAILURE;
+		}
+
+		clSimulationKernel->candidateRowCounts = clCreateBuffer(clState.context, CL_MEM_READ_WRITE,
+		                                                        sizeof(cl_uint) * numberParticles * systems, nullptr,
+		                                                        &err);
+		if (err != CL_SUCCESS) {
+			printf("Error: Failed to allocate device memory! %d\n", err);
+			return EXIT_FAILURE;
+		}
+
+		clSimulationKernel->candidateGroupCounts = clCreateBuffer(clState.context, CL_MEM_READ_WRITE,
+		                                                          sizeof(cl_uint) * clSimulationKernel->candidateGroups
+		                                                          * systems, nullptr, &err);
+		if (err != CL_SUCCESS) {
+			printf("Error: Failed to allocate device memory! %d\n", err);
+			return EXIT_FAILURE;
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
+
+// Fills a zeroed struct, on failure what was created so far is left in it
+static int createSimulationKernel(struct ClState clState, struct ClSimulationKernel * clSimulationKernel) {
+	const cl_uint systems = clSimulationKernel->systems;
+
+	{ // Create the compute kernels in the program we wish to run, the first failure skips the rest
+		cl_int err = CL_SUCCESS;
+		clSimulationKernel->calculateIntersectionTimeKernel =
+			createKernel(clState.program, "calculateIntersectionTime", &err);
+		clSimulationKernel->calculateIntersectionBorderTimeKernel =
+			createKernel(clState.program, "calculateIntersectionBorderTime", &err);
+		clSimulationKernel->findMinKernel = createKernel(clState.program, "findMin", &err);
+		clSimulationKernel->advanceSimulationKernel = createKernel(clState.program, "advanceSimulation", &err);
+		clSimulationKernel->calculateMortonCodesKernel = createKernel(clState.program, "calculateMortonCodes", &err);
+		clSimulationKernel->radixCountKernel = createKernel(clState.program, "radixCount", &err);
+		clSimulationKernel->radixScanKernel = createKernel(clState.program, "radixScan", &err);
+		clSimulationKernel->radixScatterKernel = createKernel(clState.program, "radixScatter", &err);
+		clSimulationKernel->reorderParticlesKernel = createKernel(clState.program, "reorderParticles", &err);
+		clSimulationKernel->buildNeighborListsKernel = createKernel(clState.program, "buildNeighborLists", &err);
+		clSimulationKernel->calculateNeighborIntersectionTimeKernel =
+			createKernel(clState.program, "calculateNeighborIntersectionTime", &err);
+		clSimulationKernel->calculateFusedIntersectionTimeKernel =
+			createKernel(clState.program, "calculateFusedIntersectionTime", &err);
+		clSimulationKernel->findMinFusedKernel = createKernel(clState.program, "findMinFused", &err);
+		clSimulationKernel->simulatePersistentKernel = createKernel(clState.program, "simulatePersistent", &err);
+		clSimulationKernel->countCandidatesKernel = createKernel(clState.program, "countCandidates", &err);
+		clSimulationKernel->scanCandidatesKernel = createKernel(clState.program, "scanCandidates", &err);
+		clSimulationKernel->compactCandidatesKernel = createKernel(clState.program, "compactCandidates", &err);
+		if (err != CL_SUCCESS) {
+			return EXIT_FAILURE;
+		}
+	}
+
+	clSimulationKernel->zeroCopy = clState.hostUnifiedMemory;
+	const cl_mem_flags particlesFlags = CL_MEM_READ_WRITE | (clSimulationKernel->zeroCopy ? CL_MEM_ALLOC_HOST_PTR : 0);
+
+	{ // Create the input array in device memory for our calculation
+		cl_int err;
+		clSimulationKernel->particlesInput = clCreateBuffer(clState.context, particlesFlags,
+		                                                       sizeof(struct Particle) * numberParticles * systems,
+		                                                    nullptr, &err);
+		if (err != CL_SUCCESS) {
+			printf("Error: Failed to allocate device memory! %d\n", err);
+			return EXIT_FAILURE;
+		}
+	}
+
+	{ // Create the output array in device memory for our calculation
+		cl_int err;
+		clSimulationKernel->particlesOutput = clCreateBuffer(clState.context, particlesFlags,
+		                                                    sizeof(struct Particle) * numberParticles * systems,
+		                                                    nullptr, &err);
+		if (err != CL_SUCCESS) {
+			printf("Error: Failed to allocate device memory! %d\n", err);
+			return EXIT_FAILURE;
+		}
+	}
+
+	clSimulationKernel->fused = fusedIntersectionTime;
+	if (allocatePairTimes(clState, clSimulationKernel) != EXIT_SUCCESS) {
+		return EXIT_FAILURE;
+	}
+
+	{ // Create the output array in device memory for our calculation
+		cl_int err;
+		clSimulationKernel->collidedParticles = clCreateBuffer(clState.context, CL_MEM_READ_WRITE,
+		                                                       sizeof(struct Collision) * numberParticles * systems,
+		                                                       nullptr, &err);
+		if (err != CL_SUCCESS) {
+			printf("Error: Failed to allocate device memory! %d\n", err);
+			return EXIT_FAILURE;
+		}
+	}
+
+	{ // Create the output array in device memory for our calculation
+		cl_int err;
+		clSimulationKernel->minimumTime = clCreateBuffer(clState.context, CL_MEM_READ_WRITE, sizeof(Time) * systems,
+		                                                 nullptr, &err);
+		if (err != CL_SUCCESS) {
+			printf("Error: Failed to allocate device memory! %d\n", err);
+			return EXIT_FAILURE;
+		}
+	}
+
+	{ // Create the input array in device memory for our calculation
+		cl_int err;
+		clSimulationKernel->horizons = clCreateBuffer(clState.context, CL_MEM_READ_WRITE, sizeof(Time) * systems,
+		                                              nullptr, &err);
+		if (err != CL_SUCCESS) {
+			printf("Error: Failed to allocate device memory! %d\n", err);
+			return EXIT_FAILURE;
+		}
+	}
+
+	{ // Create the output array in device memory for our calculation
+		cl_int err;
+		clSimulationKernel->eventRecords = clCreateBuffer(clState.context, CL_MEM_READ_WRITE,
+		                                                  sizeof(struct EventRecord) * systems, nullptr, &err);
+		if (err != CL_SUCCESS) {
+			printf("Error: Failed to allocate device memory! %d\n", err);
+			return EXIT_FAILURE;
+		}
+
+		clSimulationKernel->eventCounts = clCreateBuffer(clState.context, CL_MEM_READ_WRITE, sizeof(cl_uint) * systems,
+		                                                 nullptr, &err);
+		if (err != CL_SUCCESS) {
+			printf("Error: Failed to allocate device memory! %d\n", err);
+			return EXIT_FAILURE;
+		}
+	}
+
+	{ // Create the outcome counters in device memory
+		cl_int err;
+		clSimulationKernel->outcomeCounters = clCreateBuffer(clState.context, CL_MEM_READ_WRITE,
+		                                                     sizeof(struct OutcomeCounters), nullptr, &err);
+		if (err != CL_SUCCESS) {
+			printf("Error: Failed to allocate device memory! %d\n", err);
+			return EXIT_FAILURE;
+		}
+
+		const cl_uint zero = 0;
+		err = clEnqueueFillBuffer(clState.commands, clSimulationKernel->outcomeCounters, &zero, sizeof(zero), 0,
+		                          sizeof(struct OutcomeCounters), 0, nullptr, nullptr);
+		if (err != CL_SUCCESS) {
+			printf("Error: Failed to clear outcome counters! %d\n", err);
+			return EXIT_FAILURE;
+		}
+	}
+
+	{ // Create the candidate counters in device memory
+		cl_int err;
+		clSimulationKernel->candidateCounters = clCreateBuffer(clState.context, CL_MEM_READ_WRITE,
+		                                                       sizeof(struct CandidateCounters), nullptr, &err);
+		if (err != CL_SUCCESS) {
+			printf("Error: Failed to allocate device memory! %d\n", err);
+			return EXIT_FAILURE;
+		}
+
+		const cl_uint zero = 0;
+		err = clEnqueueFillBuffer(clState.commands, clSimulationKernel->candidateCounters, &zero, sizeof(zero), 0,
+		                          sizeof(struct CandidateCounters), 0, nullptr, nullptr);
+		if (err != CL_SUCCESS) {
+			printf("Error: Failed to clear candidate counters! %d\n", err);
+			return EXIT_FAILURE;
+		}
+	}
+
+	{ // Create the particle ids in device memory, every slot starts with its own particle
+		cl_int err;
+		clSimulationKernel->particleIds = clCreateBuffer(clState.context, CL_MEM_READ_WRITE,
+		                                                 sizeof(cl_uint) * numberParticles * systems, nullptr, &err);
+		if (err != CL_SUCCESS) {
+			printf("Error: Failed to allocate device memory! %d\n", err);
+			return EXIT_FAILURE;
+		}
+
+		clSimulationKernel->particleIdsOutput = clCreateBuffer(clState.context, CL_MEM_READ_WRITE,
+		                                                       sizeof(cl_uint) * numberParticles * systems, nullptr,
+		                                                       &err);
+		if (err != CL_SUCCESS) {
+			printf("Error: Failed to allocate device memory! %d\n", err);
+			return EXIT_FAILURE;
+		}
+	}
+
+	{ // Create the radix sort arrays in device memory
+		for (uint k = 0; k < 2; k++) {
+			cl_int err;
+			clSimulationKernel->mortonKeys[k] = clCreateBuffer(clState.context, CL_MEM_READ_WRITE,
+			                                                   sizeof(cl_uint) * numberParticles * systems, nullptr,
+			                                                   &err);
+			if (err != CL_SUCCESS) {
+				printf("Error: Failed to allocate device memory! %d\n", err);
+				return EXIT_FAILURE;
+			}
+
+			clSimulationKernel->mortonValues[k] = clCreateBuffer(clState.context, CL_MEM_READ_WRITE,
+			                                                     sizeof(cl_uint) * numberParticles * systems, nullptr,
+			                                                     &err);
+			if (err != CL_SUCCESS) {
+				printf("Error: Failed to allocate device memory! %d\n", err);
+				return EXIT_FAILURE;
+			}
+		}
+
+		cl_int err;
+		clSimulationKernel->radixHistograms = clCreateBuffer(clState.context, CL_MEM_READ_WRITE,
+		                                                     sizeof(cl_uint) * radixDigits * radixChunks * systems,
+		                                                     nullptr, &err);
+		if (err != CL_SUCCESS) {
+			printf("Error: Failed to allocate device memory! %d\n", err);
+			return EXIT_FAILURE;
+		}
+	}
+
+	{ // Create the neighbor lists in device memory, every system starts by building its lists
+		cl_int err;
+		clSimulationKernel->neighbors = clCreateBuffer(clState.context, CL_MEM_READ_WRITE,
+		                                               sizeof(cl_uint) * maxNeighbors * numberParticles * systems,
+		                                               nullptr, &err);
+		if (err != CL_SUCCESS) {
+			printf("Error: Failed to allocate device memory! %d\n", err);
+			return EXIT_FAILURE;
+		}
+
+		clSimulationKernel->neighborCounts = clCreateBuffer(clState.context, CL_MEM_READ_WRITE,
+		                                                    sizeof(cl_uint) * numberParticles * systems, nullptr, &err);
+		if (err != CL_SUCCESS) {
+			printf("Error: Failed to allocate device memory! %d\n", err);
+			return EXIT_FAILURE;
+		}
+
+		clSimulationKernel->displacements = clCreateBuffer(clState.context, CL_MEM_READ_WRITE,
+		                                                   sizeof(cl_float) * numberParticles * systems, nullptr, &err);
+		if (err != CL_SUCCESS) {
+			printf("Error: Failed to allocate device memory! %d\n", err);
+			return EXIT_FAILURE;
+		}
+
+		clSimulationKernel->rebuildFlags = clCreateBuffer(clState.context, CL_MEM_READ_WRITE, sizeof(cl_uint) * systems,
+		                                                  nullptr, &err);
+		if (err != CL_SUCCESS) {
+			printf("Error: Failed to allocate device memory! %d\n", err);
+			return EXIT_FAILURE;
+		}
+
+		clSimulationKernel->neighborCounters = clCreateBuffer(clState.context, CL_MEM_READ_WRITE,
+		                                                      sizeof(struct NeighborCounters), nullptr, &err);
+		if (err != CL_SUCCESS) {
+			printf("Error: Failed to allocate device memory! %d\n", err);
+			return EXIT_FAILURE;
+		}
+
+		const cl_uint zero = 0;
+		const cl_float zeroDisplacement = 0;
+		const cl_uint rebuild = 1;
+		err = clEnqueueFillBuffer(clState.commands, clSimulationKernel->displacements, &zeroDisplacement,
+		                          sizeof(zeroDisplacement), 0, sizeof(cl_float) * numberParticles * systems, 0,
+		                          nullptr, nullptr);
+		err |= clEnqueueFillBuffer(clState.commands, clSimulationKernel->rebuildFlags, &rebuild, sizeof(rebuild), 0,
+		                           sizeof(cl_uint) * systems, 0, nullptr, nullptr);
+		err |= clEnqueueFillBuffer(clState.commands, clSimulationKernel->neighborCounters, &zero, sizeof(zero), 0,
+		                           sizeof(struct NeighborCounters), 0, nullptr, nullptr);
+		if (err != CL_SUCCESS) {
+			printf("Error: Failed to clear neighbor lists! %d\n", err);
+			return EXIT_FAILURE;
+		}
+
+		clSimulationKernel->skin = neighborSkin;
+	}
+
+	if (traceLevel > TRACE_LEVEL_OFF) { // Create the trace ring buffer and its cursor in device memory
+		cl_int err;
+		clSimulationKernel->traceEvents = clCreateBuffer(clState.context, CL_MEM_READ_WRITE,
+		                                                 sizeof(struct TraceEvent) * traceCapacity, nullptr, &err);
+		if (err != CL_SUCCESS) {
+			printf("Error: Failed to allocate device memory! %d\n", err);
+			return EXIT_FAILURE;
+		}
+
+		clSimulationKernel->traceCursor = clCreateBuffer(clState.context, CL_MEM_READ_WRITE, sizeof(cl_uint),
+		                                                 nullptr, &err);
+		if (err != CL_SUCCESS) {
+			printf("Error: Failed to allocate device memory! %d\n", err);
+			return EXIT_FAILURE;
+		}
+
+		const cl_uint zero = 0;
+		err = clEnqueueFillBuffer(clState.commands, clSimulationKernel->traceCursor, &zero, sizeof(zero), 0,
+		                          sizeof(zero), 0, nullptr, nullptr);
+		if (err != CL_SUCCESS) {
+			printf("Error: Failed to clear trace cursor! %d\n", err);
+			return EXIT_FAILURE;
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
+
+static struct ClSimulationKernel initSimulationKernel(struct ClState clState, cl_uint systems) {
+	struct ClSimulationKernel clSimulationKernel = {0};
+	clSimulationKernel.systems = systems;
+
+	if (!clState.success || createSimulationKernel(clState, &clSimulationKernel) != EXIT_SUCCESS) {
+		releaseClSimulationKernel(clSimulationKernel);
+
+		clSimulationKernel = (struct ClSimulationKernel) {0};
+		clSimulationKernel.success = false;
+		return clSimulationKernel;
+	}
+
+	clSimulationKernel.success = true;
+	return clSimulationKernel;
+}
+
+// The trace parameters are always the last ones of every kernel
+// Global sizes of the kernels that count outcomes are rounded up to whole work groups
+static size_t roundUp(size_t value, size_t multiple) {
+	return (value + multiple - 1) / multiple * multiple;
+}
+
+static cl_int setTraceKernelArguments(cl_kernel kernel, cl_uint firstIndex,
+                                      struct ClSimulationKernel clSimulationKernel) {
+	if (traceLevel == TRACE_LEVEL_OFF) {
+		return CL_SUCCESS;
+	}
+
+	cl_int err = clSetKernelArg(kernel, firstIndex, sizeof(typeof(clSimulationKernel.traceEvents)),
+	                            &clSimulationKernel.traceEvents);
+	err |= clSetKernelArg(kernel, firstIndex + 1, sizeof(typeof(clSimulationKernel.traceCursor)),
+	                      &clSimulationKernel.traceCursor);
+	return err;
+}
+
+// The queue is in order, so the kernels of a step, and of many steps, are only enqueued, the host waits when it reads
+// something back
+static int callSimulation(struct ClState clState, struct ClSimulationKernel clSimulationKernel) {
+	if (clSimulationKernel.skin > 0) { // buildNeighborLists(particlesInput, intersectionTimes, neighbors, neighborCounts, displacements, rebuildFlags, neighborCounters, skin);
+		{ // Set the arguments to our compute kernel
+			cl_int err = clSetKernelArg(clSimulationKernel.buildNeighborListsKernel, 0,
+			                            sizeof(typeof(clSimulationKernel.particlesInput)),
+			                            &clSimulationKernel.particlesInput);
+			// A nullptr buffer reaches the kernel as a null pointer, the fused kernels have no matrix
+			err |= clSetKernelArg(clSimulationKernel.buildNeighborListsKernel, 1,
+			                      sizeof(typeof(clSimulationKernel.intersectionTimes)),
+			                      &clSimulationKernel.intersectionTimes);
+			err |= clSetKernelArg(clSimulationKernel.buildNeighborListsKernel, 2,
+			                      sizeof(typeof(clSimulationKernel.neighbors)), &clSimulationKernel.neighbors);
+			err |= clSetKernelArg(clSimulationKernel.buildNeighborListsKernel, 3,
+			                      sizeof(typeof(clSimulationKernel.neighborCounts)), &clSimulationKernel.neighborCounts);
+			err |= clSetKernelArg(clSimulationKernel.buildNeighborListsKernel, 4,
+			                      sizeof(typeof(clSimulationKernel.displacements)), &clSimulationKernel.displacements);
+			err |= clSetKernelArg(clSimulationKernel.buildNeighborListsKernel, 5,
+			                      sizeof(typeof(clSimulationKernel.rebuildFlags)), &clSimulationKernel.rebuildFlags);
+			err |= clSetKernelArg(clSimulationKernel.buildNeighborListsKernel, 6,
+			                      sizeof(typeof(clSimulationKernel.neighborCounters)),
+			                      &clSimulationKernel.neighborCounters);
+			err |= clSetKernelArg(clSimulationKernel.buildNeighborListsKernel, 7,
+			                      sizeof(typeof(clSimulationKernel.skin)), &clSimulationKernel.skin);
+			if (err != CL_SUCCESS) {
+				printf("Error: Failed to set kernel arguments! %d\n", err);
+				return EXIT_FAILURE;
+			}
+		}
+
+		{ // Systems that do not need new lists return right away
+			size_t global[2] = { numberParticles, clSimulationKernel.systems };
+			cl_int err = clEnqueueNDRangeKernel(clState.commands, clSimulationKernel.buildNeighborListsKernel, 2,
+			                                    nullptr, global, nullptr, 0, nullptr, nullptr);
+			if (err != CL_SUCCESS) {
+				printf("Error: Failed to execute kernel! %d\n", err);
+				return EXIT_FAILURE;
+			}
+		}
+	}
+	if (!clSimulationKernel.fused && clSimulationKernel.skin > 0) { // calculateNeighborIntersectionTime(particlesInput, neighbors, neighborCounts, intersectionTimes, outcomeCounters);
+		{ // Set the arguments to our compute kernel
+			cl_int err = clSetKernelArg(clSimulationKernel.calculateNeighborIntersectionTimeKernel, 0,
+			                            sizeof(typeof(clSimulationKernel.particlesInput)),
+			                            &clSimulationKernel.particlesInput);
+			err |= clSetKernelArg(clSimulationKernel.calculateNeighborIntersectionTimeKernel, 1,
+			                      sizeof(typeof(clSimulationKernel.neighbors)), &clSimulationKernel.neighbors);
+			err |= clSetKernelArg(clSimulationKernel.calculateNeighborIntersectionTimeKernel, 2,
+			                      sizeof(typeof(clSimulationKernel.neighborCounts)), &clSimulationKernel.neighborCounts);
+			err |= clSetKernelArg(clSimulationKernel.calculateNeighborIntersectionTimeKernel, 3,
+			                      sizeof(typeof(clSimulationKernel.intersectionTimes)),
+			                      &clSimulationKernel.intersectionTimes);
+			err |= clSetKernelArg(clSimulationKernel.calculateNeighborIntersectionTimeKernel, 4,
+			                      sizeof(typeof(clSimulationKernel.outcomeCounters)),
+			                      &clSimulationKernel.outcomeCounters);
+			err |= setTraceKernelArguments(clSimulationKernel.calculateNeighborIntersectionTimeKernel, 5,
+			                               clSimulationKernel);
+			if (err != CL_SUCCESS) {
+				printf("Error: Failed to set kernel arguments! %d\n", err);
+				return EXIT_FAILURE;
+			}
+		}
+
+		{ // Execute the kernel over every particle and every slot of its neighbor list, a work group per list
+			size_t global[3] = { numberParticles, maxNeighbors, clSimulationKernel.systems };
+			size_t localSizes[3] = { 1, maxNeighbors, 1 };
+			cl_int err = clEnqueueNDRangeKernel(clState.commands,
+			                                    clSimulationKernel.calculateNeighborIntersectionTimeKernel, 3, nullptr,
+			                                    global, localSizes, 0, nullptr, nullptr);
+			if (err != CL_SUCCESS) {
+				printf("Error: Failed to execute kernel! %d\n", err);
+				return EXIT_FAILURE;
+			}
+		}
+	} else if (!clSimulationKernel.fused) { // calculateIntersectionTime(particlesInput, intersectionTimes, outcomeCounters);
+		{ // Set the arguments to our compute kernel
+			cl_int err = clSetKernelArg(clSimulationKernel.calculateIntersectionTimeKernel, 0,
+			                            sizeof(typeof(clSimulationKernel.particlesInput)),
+			                            &clSimulationKernel.particlesInput);
+			err |= clSetKernelArg(clSimulationKernel.calculateIntersectionTimeKernel, 1,
+			                      sizeof(typeof(clSimulationKernel.intersectionTimes)),
+			                      &clSimulationKernel.intersectionTimes);
+			err |= clSetKernelArg(clSimulationKernel.calculateIntersectionTimeKernel, 2,
+			                      sizeof(typeof(clSimulationKernel.outcomeCounters)),
+			                      &clSimulationKernel.outcomeCounters);
+			err |= setTraceKernelArguments(clSimulationKernel.calculateIntersectionTimeKernel, 3, clSimulationKernel);
+			if (err != CL_SUCCESS) {
+				printf("Error: Failed to set kernel arguments! %d\n", err);
+				return EXIT_FAILURE;
+			}
+		}
+
+		{ // Execute the kernel over every pair of every system in squares of outcomeGroupSide pairs a side, every work
+			// item takes pairVectorWidth consecutive partners
+			size_t global[3] = {
+				roundUp(numberParticles, outcomeGroupSide),
+				roundUp((numberParticles + clState.pairVectorWidth - 1) / clState.pairVectorWidth, outcomeGroupSide),
+				clSimulationKernel.systems
+			};
+			size_t localSizes[3] = { outcomeGroupSide, outcomeGroupSide, 1 };
+			cl_int err = clEnqueueNDRangeKernel(clState.commands, clSimulationKernel.calculateIntersectionTimeKernel, 3,
+			                                    nullptr, global, localSizes, 0, nullptr, nullptr);
+			if (err != CL_SUCCESS) {
+				printf("Error: Failed to execute kernel! %d\n", err);
+				return EXIT_FAILURE;
+			}
+		}
+	}
+	if (!clSimulationKernel.fused) { // calculateIntersectionBorderTime(initialPositions, intersectionTimes, collidedParticles, outcomeCounters);
+		{ // Set the arguments to our compute kernel
+			cl_int err = clSetKernelArg(clSimulationKernel.calculateIntersectionBorderTimeKernel, 0,
+			                            sizeof(typeof(clSimulationKernel.particlesInput)),
+			                            &clSimulationKernel.particlesInput);
+			err |= clSetKernelArg(clSimulationKernel.calculateIntersectionBorderTimeKernel, 1,
+			                      sizeof(typeof(clSimulationKernel.intersectionTimes)),
+			                      &clSimulationKernel.intersectionTimes);
+			err |= clSetKernelArg(clSimulationKernel.calculateIntersectionBorderTimeKernel, 2,
+			                      sizeof(typeof(clSimulationKernel.collidedParticles)),
+			                      &clSimulationKernel.collidedParticles);
+			err |= clSetKernelArg(clSimulationKernel.calculateIntersectionBorderTimeKernel, 3,
+			                      sizeof(typeof(clSimulationKernel.outcomeCounters)),
+			                      &clSimulationKernel.outcomeCounters);
+			err |= setTraceKernelArguments(clSimulationKernel.calculateIntersectionBorderTimeKernel, 4,
+			                               clSimulationKernel);
+			if (err != CL_SUCCESS) {
+				printf("Error: Failed to set kernel arguments! %d\n", err);
+				return EXIT_FAILURE;
+			}
+		}
+
+		{ // Execute the kernel over every particle of every system, the particles are rounded up to whole work groups
+			size_t global[2] = { roundUp(numberParticles, outcomeGroupSize), clSimulationKernel.systems };
+			size_t localSizes[2] = { outcomeGroupSize, 1 };
+			cl_int err = clEnqueueNDRangeKernel(clState.commands, clSimulationKernel.calculateIntersectionBorderTimeKernel, 2,
+			                                    nullptr, global, localSizes, 0, nullptr, nullptr);
+			if (err != CL_SUCCESS) {
+				printf("Error: Failed to execute kernel! %d\n", err);
+				return EXIT_FAILURE;
+			}
+		}
+	}
+	if (!clSimulationKernel.fused && !compactCandidates) { // findMin(intersectionTimes, collidedParticles, minimumTime, horizons, particlesInput, displacements, rebuildFlags, skin, eventRecords, eventCounts);
+		{ // Set the arguments to our compute kernel
+			cl_int err = clSetKernelArg(clSimulationKernel.findMinKernel, 0,
+			                      sizeof(typeof(clSimulationKernel.intersectionTimes)),
+			                      &clSimulationKernel.intersectionTimes);
+			err |= clSetKernelArg(clSimulationKernel.findMinKernel, 1,
+			                      sizeof(typeof(clSimulationKernel.collidedParticles)),
+			                      &clSimulationKernel.collidedParticles);
+			err |= clSetKernelArg(clSimulationKernel.findMinKernel, 2,
+			                      sizeof(typeof(clSimulationKernel.minimumTime)),
+			                      &clSimulationKernel.minimumTime);
+			err |= clSetKernelArg(clSimulationKernel.findMinKernel, 3,
+			                      sizeof(typeof(clSimulationKernel.horizons)),
+			                      &clSimulationKernel.horizons);
+			err |= clSetKernelArg(clSimulationKernel.findMinKernel, 4,
+			                      sizeof(typeof(clSimulationKernel.particlesInput)),
+			                      &clSimulationKernel.particlesInput);
+			err |= clSetKernelArg(clSimulationKernel.findMinKernel, 5,
+			                      sizeof(typeof(clSimulationKernel.displacements)),
+			                      &clSimulationKernel.displacements);
+			err |= clSetKernelArg(clSimulationKernel.findMinKernel, 6,
+			                      sizeof(typeof(clSimulationKernel.rebuildFlags)),
+			                      &clSimulationKernel.rebuildFlags);
+			err |= clSetKernelArg(clSimulationKernel.findMinKernel, 7,
+			                      sizeof(typeof(clSimulationKernel.skin)), &clSimulationKernel.skin);
+			err |= clSetKernelArg(clSimulationKernel.findMinKernel, 8,
+			                      sizeof(typeof(clSimulationKernel.eventRecords)), &clSimulationKernel.eventRecords);
+			err |= clSetKernelArg(clSimulationKernel.findMinKernel, 9,
+			                      sizeof(typeof(clSimulationKernel.eventCounts)), &clSimulationKernel.eventCounts);
+			err |= setTraceKernelArguments(clSimulationKernel.findMinKernel, 10, clSimulationKernel);
+			if (err != CL_SUCCESS) {
+				printf("Error: Failed to set kernel arguments! %d\n", err);
+				return EXIT_FAILURE;
+			}
+		}
+
+		{ // One work item per system
+			size_t global = clSimulationKernel.systems;
+			cl_int err = clEnqueueNDRangeKernel(clState.commands, clSimulationKernel.findMinKernel, 1,
+			                                    nullptr, &global, nullptr, 0, nullptr, nullptr);
+			if (err != CL_SUCCESS) {
+				printf("Error: Failed to execute kernel! %d\n", err);
+				return EXIT_FAILURE;
+			}
+		}
+	}
+	if (!clSimulationKernel.fused && compactCandidates) { // countCandidates(intersectionTimes, horizons, candidateRowCounts, candidateGroupCounts);
+		{ // Set the arguments to our compute kernel
+			cl_int err = clSetKernelArg(clSimulationKernel.countCandidatesKernel, 0,
+			                            sizeof(typeof(clSimulationKernel.intersectionTimes)),
+			                            &clSimulationKernel.intersectionTimes);
+			err |= clSetKernelArg(clSimulationKernel.countCandidatesKernel, 1,
+			                      sizeof(typeof(clSimulationKernel.horizons)), &clSimulationKernel.horizons);
+			err |= clSetKernelArg(clSimulationKernel.countCandidatesKernel, 2,
+			                      sizeof(typeof(clSimulationKernel.candidateRowCounts)),
+			                      &clSimulationKernel.candidateRowCounts);
+			err |= clSetKernelArg(clSimulationKernel.countCandidatesKernel, 3,
+			                      sizeof(typeof(clSimulationKernel.candidateGroupCounts)),
+			                      &clSimulationKernel.candidateGroupCounts);
+			if (err != CL_SUCCESS) {
+				printf("Error: Failed to set kernel arguments! %d\n", err);
+				return EXIT_FAILURE;
+			}
+		}
+
+		{ // The rows are rounded up to whole work groups, the kernel requires candidateGroupSize
+			size_t global[2] = { clSimulationKernel.candidateGroups * candidateGroupSize, clSimulationKernel.systems };
+			size_t localSizes[2] = { candidateGroupSize, 1 };
+			cl_int err = clEnqueueNDRangeKernel(clState.commands, clSimulationKernel.countCandidatesKernel, 2, nullptr,
+			                                    global, localSizes, 0, nullptr, nullptr);
+			if (err != CL_SUCCESS) {
+				printf("Error: Failed to execute kernel! %d\n", err);
+				return EXIT_FAILURE;
+			}
+		}
+	}
+	if (!clSimulationKernel.fused && compactCandidates) { // scanCandidates(candidateGroupCounts, candidateGroups, candidateCapacity, candidateCounts, candidateCounters);
+		{ // Set the arguments to our compute kernel
+			cl_int err = clSetKernelArg(clSimulationKernel.scanCandidatesKernel, 0,
+			                            sizeof(typeof(clSimulationKernel.candidateGroupCounts)),
+			                            &clSimulationKernel.candidateGroupCounts);
+			err |= clSetKernelArg(clSimulationKernel.scanCandidatesKernel, 1,
+			                      sizeof(typeof(clSimulationKernel.candidateGroups)),
+			                      &clSimulationKernel.candidateGroups);
+			err |= clSetKernelArg(clSimulationKernel.scanCandidatesKernel, 2,
+			                      sizeof(typeof(clSimulationKernel.candidateCapacity)),
+			                      &clSimulationKernel.candidateCapacity);
+			err |= clSetKernelArg(clSimulationKernel.scanCandidatesKernel, 3,
+			                      sizeof(typeof(clSimulationKernel.candidateCounts)),
+			                      &clSimulationKernel.candidateCounts);
+			err |= clSetKernelArg(clSimulationKernel.scanCandidatesKernel, 4,
+			                      sizeof(typeof(clSimulationKernel.candidateCounters)),
+			                      &clSimulationKernel.candidateCounters);
+			if (err != CL_SUCCESS) {
+				printf("Error: Failed to set kernel arguments! %d\n", err);
+				return EXIT_FAILURE;
+			}
+		}
+
+		{ // One work group per system, the kernel requires candidateGroupSize
+			size_t global[2] = { candidateGroupSize, clSimulationKernel.systems };
+			size_t localSizes[2] = { candidateGroupSize, 1 };
+			cl_int err = clEnqueueNDRangeKernel(clState.commands, clSimulationKernel.scanCandidatesKernel, 2, nullptr,
+			                                    global, localSizes, 0, nullptr, nullptr);
+			if (err != CL_SUCCESS) {
+				printf("Error: Failed to execute kernel! %d\n", err);
+				return EXIT_FAILURE;
+			}
+		}
+	}
+	if (!clSimulationKernel.fused && compactCandidates) { // compactCandidates(intersectionTimes, collidedParticles, horizons, candidateRowCounts, candidateGroupCounts, candidates, candidateCapacity);
+		{ // Set the arguments to our compute kernel
+			cl_int err = clSetKernelArg(clSimulationKernel.compactCandidatesKernel, 0,
+			                            sizeof(typeof(clSimulationKernel.intersectionTimes)),
+			                            &clSimulationKernel.intersectionTimes);
+			err |= clSetKernelArg(clSimulationKernel.compactCandidatesKernel, 1,
+			                      sizeof(typeof(clSimulationKernel.collidedParticles)),
+			                      &clSimulationKernel.collidedParticles);
+			err |= clSetKernelArg(clSimulationKernel.compactCandidatesKernel, 2,
+			                      sizeof(typeof(clSimulationKernel.horizons)), &clSimulationKernel.horizons);
+			err |= clSetKernelArg(clSimulationKernel.compactCandidatesKernel, 3,
+			                      sizeof(typeof(clSimulationKernel.candidateRowCounts)),
+			                      &clSimulationKernel.candidateRowCounts);
+			err |= clSetKernelArg(clSimulationKernel.compactCandidatesKernel, 4,
+			                      sizeof(typeof(clSimulationKernel.candidateGroupCounts)),
+			                      &clSimulationKernel.candidateGroupCounts);
+			err |= clSetKernelArg(clSimulationKernel.compactCandidatesKernel, 5,
+			                      sizeof(typeof(clSimulationKernel.candidates)), &clSimulationKernel.candidates);
+			err |= clSetKernelArg(clSimulationKernel.compactCandidatesKernel, 6,
+			                      sizeof(typeof(clSimulationKernel.candidateCapacity)),
+			                      &clSimulationKernel.candidateCapacity);
+			if (err != CL_SUCCESS) {
+				printf("Error: Failed to set kernel arguments! %d\n", err);
+				return EXIT_FAILURE;
+			}
+		}
+
+		{ // Same work groups as countCandidates, every group finds its offset where that one left its count
+			size_t global[2] = { clSimulationKernel.candidateGroups * candidateGroupSize, clSimulationKernel.systems };
+			size_t localSizes[2] = { candidateGroupSize, 1 };
+			cl_int err = clEnqueueNDRangeKernel(clState.commands, clSimulationKernel.compactCandidatesKernel, 2, nullptr,
+			                                    global, localSizes, 0, nullptr, nullptr);
+			if (err != CL_SUCCESS) {
+				printf("Error: Failed to execute kernel! %d\n", err);
+				return EXIT_FAILURE;
+			}
+		}
+	}
+	if (clSimulationKernel.fused) { // calculateFusedIntersectionTime(particlesInput, neighbors, neighborCounts, skin, horizons, fusedWinners, outcomeCounters, candidateCounters);
+		{ // Set the arguments to our compute kernel
+			cl_int err = clSetKernelArg(clSimulationKernel.calculateFusedIntersectionTimeKernel, 0,
+			                            sizeof(typeof(clSimulationKernel.particlesInput)),
+			                            &clSimulationKernel.particlesInput);
+			err |= clSetKernelArg(clSimulationKernel.calculateFusedIntersectionTimeKernel, 1,
+			                      sizeof(typeof(clSimulationKernel.neighbors)), &clSimulationKernel.neighbors);
+			err |= clSetKernelArg(clSimulationKernel.calculateFusedIntersectionTimeKernel, 2,
+			                      sizeof(typeof(clSimulationKernel.neighborCounts)), &clSimulationKernel.neighborCounts);
+			err |= clSetKernelArg(clSimulationKernel.calculateFusedIntersectionTimeKernel, 3,
+			                      sizeof(typeof(clSimulationKernel.skin)), &clSimulationKernel.skin);
+			err |= clSetKernelArg(clSimulationKernel.calculateFusedIntersectionTimeKernel, 4,
+			                      sizeof(typeof(clSimulationKernel.horizons)), &clSimulationKernel.horizons);
+			err |= clSetKernelArg(clSimulationKernel.calculateFusedIntersectionTimeKernel, 5,
+			                      sizeof(typeof(clSimulationKernel.fusedWinners)), &clSimulationKernel.fusedWinners);
+			err |= clSetKernelArg(clSimulationKernel.calculateFusedIntersectionTimeKernel, 6,
+			                      sizeof(typeof(clSimulationKernel.outcomeCounters)),
+			                      &clSimulationKernel.outcomeCounters);
+			err |= clSetKernelArg(clSimulationKernel.calculateFusedIntersectionTimeKernel, 7,
+			                      sizeof(typeof(clSimulationKernel.candidateCounters)),
+			                      &clSimulationKernel.candidateCounters);
+			err |= setTraceKernelArguments(clSimulationKernel.calculateFusedIntersectionTimeKernel, 8,
+			                               clSimulationKernel);
+			if (err != CL_SUCCESS) {
+				printf("Error: Failed to set kernel arguments! %d\n", err);
+				return EXIT_FAILURE;
+			}
+		}
+
+		{ // The particles are rounded up to whole work groups, the kernel requires fusedGroupSize
+			size_t global[2] = { clSimulationKernel.fusedGroups * fusedGroupSize, clSimulationKernel.systems };
+			size_t localSizes[2] = { fusedGroupSize, 1 };
+			cl_int err = clEnqueueNDRangeKernel(clState.commands, clSimulationKernel.calculateFusedIntersectionTimeKernel,
+			                                    2, nullptr, global, localSizes, 0, nullptr, nullptr);
+			if (err != CL_SUCCESS) {
+				printf("Error: Failed to execute kernel! %d\n", err);
+				return EXIT_FAILURE;
+			}
+		}
+	}
+	if (clSimulationKernel.fused || compactCandidates) { // findMinFused(winners, groups, counts, intersectionTimes, collidedParticles, minimumTime, horizons, particlesInput, displacements, rebuildFlags, skin, eventRecords, eventCounts);
+		// The winners of the fused kernel, or the compacted candidates of the matrix of which only the first
+		// candidateCounts are used
+		const cl_mem winners = clSimulationKernel.fused ? clSimulationKernel.fusedWinners : clSimulationKernel.candidates;
+		const cl_uint groups = clSimulationKernel.fused ? clSimulationKernel.fusedGroups
+		                                                : clSimulationKernel.candidateCapacity;
+		const cl_mem counts = clSimulationKernel.fused ? nullptr : clSimulationKernel.candidateCounts;
+
+		{ // Set the arguments to our compute kernel
+			cl_int err = clSetKernelArg(clSimulationKernel.findMinFusedKernel, 0, sizeof(typeof(winners)), &winners);
+			err |= clSetKernelArg(clSimulationKernel.findMinFusedKernel, 1, sizeof(typeof(groups)), &groups);
+			err |= clSetKernelArg(clSimulationKernel.findMinFusedKernel, 2, sizeof(typeof(counts)), &counts);
+			err |= clSetKernelArg(clSimulationKernel.findMinFusedKernel, 3,
+			                      sizeof(typeof(clSimulationKernel.intersectionTimes)),
+			                      &clSimulationKernel.intersectionTimes);
+			err |= clSetKernelArg(clSimulationKernel.findMinFusedKernel, 4,
+			                      sizeof(typeof(clSimulationKernel.collidedParticles)),
+			                      &clSimulationKernel.collidedParticles);
+			err |= clSetKernelArg(clSimulationKernel.findMinFusedKernel, 5,
+			                      sizeof(typeof(clSimulationKernel.minimumTime)), &clSimulationKernel.minimumTime);
+			err |= clSetKernelArg(clSimulationKernel.findMinFusedKernel, 6,
+			                      sizeof(typeof(clSimulationKernel.horizons)), &clSimulationKernel.horizons);
+			err |= clSetKernelArg(clSimulationKernel.findMinFusedKernel, 7,
+			                      sizeof(typeof(clSimulationKernel.particlesInput)),
+			                      &clSimulationKernel.particlesInput);
+			err |= clSetKernelArg(clSimulationKernel.findMinFusedKernel, 8,
+			                      sizeof(typeof(clSimulationKernel.displacements)), &clSimulationKernel.displacements);
+			err |= clSetKernelArg(clSimulationKernel.findMinFusedKernel, 9,
+			                      sizeof(typeof(clSimulationKernel.rebuildFlags)), &clSimulationKernel.rebuildFlags);
+			err |= clSetKernelArg(clSimulationKernel.findMinFusedKernel, 10,
+			                      sizeof(typeof(clSimulationKernel.skin)), &clSimulationKernel.skin);
+			err |= clSetKernelArg(clSimulationKernel.findMinFusedKernel, 11,
+			                      sizeof(typeof(clSimulationKernel.eventRecords)), &clSimulationKernel.eventRecords);
+			err |= clSetKernelArg(clSimulationKernel.findMinFusedKernel, 12,
+			                      sizeof(typeof(clSimulationKernel.eventCounts)), &clSimulationKernel.eventCounts);
+			err |= setTraceKernelArguments(clSimulationKernel.findMinFusedKernel, 13, clSimulationKernel);
+			if (err != CL_SUCCESS) {
+				printf("Error: Failed to set kernel arguments! %d\n", err);
+				return EXIT_FAILURE;
+			}
+		}
+
+		{ // One work item per system
+			size_t global = clSimulationKernel.systems;
+			cl_int err = clEnqueueNDRangeKernel(clState.commands, clSimulationKernel.findMinFusedKernel, 1,
+			                                    nullptr, &global, nullptr, 0, nullptr, nullptr);
+			if (err != CL_SUCCESS) {
+				printf("Error: Failed to execute kernel! %d\n", err);
+				return EXIT_FAILURE;
+			}
+		}
+	}
+	{ // advanceSimulation(particlesInput, particlesOutput, collidedParticles, minimumTime, displacements, particleIds, eventRecords);
+		{ // Set the arguments to our compute kernel
+			cl_int err = clSetKernelArg(clSimulationKernel.advanceSimulationKernel, 0,
+			                            sizeof(typeof(clSimulationKernel.particlesInput)),
+			                            &clSimulationKernel.particlesInput);
+			err |= clSetKernelArg(clSimulationKernel.advanceSimulationKernel, 1,
+			                            sizeof(typeof(clSimulationKernel.particlesOutput)),
+			                            &clSimulationKernel.particlesOutput);
+			err |= clSetKernelArg(clSimulationKernel.advanceSimulationKernel, 2,
+			                            sizeof(typeof(clSimulationKernel.collidedParticles)),
+			                            &clSimulationKernel.collidedParticles);
+			err |= clSetKernelArg(clSimulationKernel.advanceSimulationKernel, 3,
+			                      sizeof(typeof(clSimulationKernel.minimumTime)),
+			                      &clSimulationKernel.minimumTime);
+			err |= clSetKernelArg(clSimulationKernel.advanceSimulationKernel, 4,
+			                      sizeof(typeof(clSimulationKernel.displacements)),
+			                      &clSimulationKernel.displacements);
+			err |= clSetKernelArg(clSimulationKernel.advanceSimulationKernel, 5,
+			                      sizeof(typeof(clSimulationKernel.particleIds)), &clSimulationKernel.particleIds);
+			err |= clSetKernelArg(clSimulationKernel.advanceSimulationKernel, 6,
+			                      sizeof(typeof(clSimulationKernel.eventRecords)), &clSimulationKernel.eventRecords);
+			err |= setTraceKernelArguments(clSimulationKernel.advanceSimulationKernel, 7, clSimulationKernel);
+			if (err != CL_SUCCESS) {
+				printf("Error: Failed to set kernel arguments! %d\n", err);
+				return EXIT_FAILURE;
+			}
+		}
+
+		{ // Execute the kernel over every particle of every system, it shares nothing within a work group so the
+			// implementation picks their size
+			size_t global[2] = { numberParticles, clSimulationKernel.systems };
+			cl_int err = clEnqueueNDRangeKernel(clState.commands, clSimulationKernel.advanceSimulationKernel, 2,
+			                                    nullptr, global, nullptr, 0, nullptr, nullptr);
+			if (err != CL_SUCCESS) {
+				printf("Error: Failed to execute kernel! %d\n", err);
+				return EXIT_FAILURE;
+			}
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
+
+// Enqueues a single launch that runs events steps of every system on the device, the particles are advanced in place
+// in particlesInput
+static int callPersistentSimulation(struct ClState clState, struct ClSimulationKernel clSimulationKernel,
+                                    cl_uint events) {
+	{ // Set the arguments to our compute kernel
+		cl_int err = clSetKernelArg(clSimulationKernel.simulatePersistentKernel, 0,
+		                            sizeof(typeof(clSimulationKernel.particlesInput)), &clSimulationKernel.particlesInput);
+		err |= clSetKernelArg(clSimulationKernel.simulatePersistentKernel, 1,
+		                      sizeof(typeof(clSimulationKernel.particleIds)), &clSimulationKernel.particleIds);
+		err |= clSetKernelArg(clSimulationKernel.simulatePersistentKernel, 2,
+		                      sizeof(typeof(clSimulationKernel.horizons)), &clSimulationKernel.horizons);
+		err |= clSetKernelArg(clSimulationKernel.simulatePersistentKernel, 3, sizeof(typeof(events)), &events);
+		err |= clSetKernelArg(clSimulationKernel.simulatePersistentKernel, 4,
+		                      sizeof(typeof(clSimulationKernel.persistentTimesteps)),
+		                      &clSimulationKernel.persistentTimesteps);
+		err |= clSetKernelArg(clSimulationKernel.simulatePersistentKernel, 5,
+		                      sizeof(typeof(clSimulationKernel.persistentEventRecords)),
+		                      &clSimulationKernel.persistentEventRecords);
+		err |= clSetKernelArg(clSimulationKernel.simulatePersistentKernel, 6,
+		                      sizeof(typeof(clSimulationKernel.eventCounts)), &clSimulationKernel.eventCounts);
+		err |= clSetKernelArg(clSimulationKernel.simulatePersistentKernel, 7,
+		                      sizeof(typeof(clSimulationKernel.outcomeCounters)), &clSimulationKernel.outcomeCounters);
+		err |= setTraceKernelArguments(clSimulationKernel.simulatePersistentKernel, 8, clSimulationKernel);
+		if (err != CL_SUCCESS) {
+			printf("Error: Failed to set kernel arguments! %d\n", err);
+			return EXIT_FAILURE;
+		}
+	}
+
+	{ // A single work group of fusedGroupSize work items for every system
+		size_t global[2] = { fusedGroupSize, clSimulationKernel.systems };
+		size_t localSizes[2] = { fusedGroupSize, 1 };
+		cl_int err = clEnqueueNDRangeKernel(clState.commands, clSimulationKernel.simulatePersistentKernel, 2, nullptr,
+		                                    global, localSizes, 0, nullptr, nullptr);
+		if (err != CL_SUCCESS) {
+			printf("Error: Failed to execute kernel! %d\n", err);
+			return EXIT_FAILURE;
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
+
+// Buffers for the results of every step of a persistent launch, 0 events releases them
+static int allocatePersistentResults(struct ClState clState, struct ClSimulationKernel * clSimulationKernel,
+                                     cl_uint events) {
+	if (clSimulationKernel->persistentEvents > 0) {
+		clReleaseMemObject(clSimulationKernel->persistentTimesteps);
+		clReleaseMemObject(clSimulationKernel->persistentEventRecords);
+		clSimulationKernel->persistentTimesteps = nullptr;
+		clSimulationKernel->persistentEventRecords = nullptr;
+		clSimulationKernel->persistentEvents = 0;
+	}
+
+	if (events == 0) {
+		return EXIT_SUCCESS;
+	}
+
+	cl_int err;
+	clSimulationKernel->persistentTimesteps = clCreateBuffer(clState.context, CL_MEM_READ_WRITE,
+	                                                         sizeof(Time) * events * clSimulationKernel->systems,
+	                                                         nullptr, &err);
+	if (err != CL_SUCCESS) {
+		printf("Error: Failed to allocate device memory! %d\n", err);
+		return EXIT_FAILURE;
+	}
+
+	clSimulationKernel->persistentEventRecords = clCreateBuffer(clState.context, CL_MEM_READ_WRITE,
+	                                                            sizeof(struct EventRecord) * events
+	                                                            * clSimulationKernel->systems, nullptr, &err);
+	if (err != CL_SUCCESS) {
+		printf("Error: Failed to allocate device memory! %d\n", err);
+		clReleaseMemObject(clSimulationKernel->persistentTimesteps);
+		clSimulationKernel->persistentTimesteps = nullptr;
+		return EXIT_FAILURE;
+	}
+
+	clSimulationKernel->persistentEvents = events;
+	return EXIT_SUCCESS;
+}
+
+static int enqueueReorderKernel(struct ClState clState, cl_kernel kernel, cl_uint dimensions, const size_t * global) {
+	cl_int err = clEnqueueNDRangeKernel(clState.commands, kernel, dimensions, nullptr, global, nullptr, 0, nullptr,
+	                                    nullptr);
+	if (err != CL_SUCCESS) {
+		printf("Error: Failed to execute kernel! %d\n", err);
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+// Sorts the particles of every system by the Morton code of their position, particleIds follows the particles
+static int callReorder(struct ClState clState, struct ClSimulationKernel * clSimulationKernel) {
+	const size_t particlesGlobal[2] = { numberParticles, clSimulationKernel->systems };
+	const size_t chunksGlobal[2] = { radixChunks, clSimulationKernel->systems };
+	const size_t systemsGlobal = clSimulationKernel->systems;
+
+	{ // calculateMortonCodes(particlesInput, mortonKeys[0], mortonValues[0]);
+		cl_int err = clSetKernelArg(clSimulationKernel->calculateMortonCodesKernel, 0, sizeof(cl_mem),
+		                            &clSimulationKernel->particlesInput);
+		err |= clSetKernelArg(clSimulationKernel->calculateMortonCodesKernel, 1, sizeof(cl_mem),
+		                      &clSimulationKernel->mortonKeys[0]);
+		err |= clSetKernelArg(clSimulationKernel->calculateMortonCodesKernel, 2, sizeof(cl_mem),
+		                      &clSimulationKernel->mortonValues[0]);
+		if (err != CL_SUCCESS) {
+			printf("Error: Failed to set kernel arguments! %d\n", err);
+			return EXIT_FAILURE;
+		}
+
+		if (enqueueReorderKernel(clState, clSimulationKernel->calculateMortonCodesKernel, 2, particlesGlobal)
+		    != EXIT_SUCCESS) {
+			return EXIT_FAILURE;
+		}
+	}
+
+	// The number of passes is even, so the sorted values end up back in mortonValues[0]
+	for (cl_uint pass = 0; pass < radixPasses; pass++) {
+		const cl_uint shift = pass * radixBits;
+		const cl_uint chunks = radixChunks;
+		const cl_mem keysInput = clSimulationKernel->mortonKeys[pass % 2];
+		const cl_mem valuesInput = clSimulationKernel->mortonValues[pass % 2];
+		const cl_mem keysOutput = clSimulationKernel->mortonKeys[(pass + 1) % 2];
+		const cl_mem valuesOutput = clSimulationKernel->mortonValues[(pass + 1) % 2];
+
+		{ // radixCount(keysInput, radixHistograms, chunks, shift);
+			cl_int err = clSetKernelArg(clSimulationKernel->radixCountKernel, 0, sizeof(cl_mem), &keysInput);
+			err |= clSetKernelArg(clSimulationKernel->radixCountKernel, 1, sizeof(cl_mem),
+			                      &clSimulationKernel->radixHistograms);
+			err |= clSetKernelArg(clSimulationKernel->radixCountKernel, 2, sizeof(chunks), &chunks);
+			err |= clSetKernelArg(clSimulationKernel->radixCountKernel, 3, sizeof(shift), &shift);
+			if (err != CL_SUCCESS) {
+				printf("Error: Failed to set kernel arguments! %d\n", err);
+				return EXIT_FAILURE;
+			}
+
+			if (enqueueReorderKernel(clState, clSimulationKernel->radixCountKernel, 2, chunksGlobal) != EXIT_SUCCESS) {
+				return EXIT_FAILURE;
+			}
+		}
+		{ // radixScan(radixHistograms, chunks);
+			cl_int err = clSetKernelArg(clSimulationKernel->radixScanKernel, 0, sizeof(cl_mem),
+			                            &clSimulationKernel->radixHistograms);
+			err |= clSetKernelArg(clSimulationKernel->radixScanKernel, 1, sizeof(chunks), &chunks);
+			if (err != CL_SUCCESS) {
+				printf("Error: Failed to set kernel arguments! %d\n", err);
+				return EXIT_FAILURE;
+			}
+
+			if (enqueueReorderKernel(clState, clSimulationKernel->radixScanKernel, 1, &systemsGlobal) != EXIT_SUCCESS) {
+				return EXIT_FAILURE;
+			}
+		}
+		{ // radixScatter(keysInput, valuesInput, keysOutput, valuesOutput, radixHistograms, chunks, shift);
+			cl_int err = clSetKernelArg(clSimulationKernel->radixScatterKernel, 0, sizeof(cl_mem), &keysInput);
+			err |= clSetKernelArg(clSimulationKernel->radixScatterKernel, 1, sizeof(cl_mem), &valuesInput);
+			err |= clSetKernelArg(clSimulationKernel->radixScatterKernel, 2, sizeof(cl_mem), &keysOutput);
+			err |= clSetKernelArg(clSimulationKernel->radixScatterKernel, 3, sizeof(cl_mem), &valuesOutput);
+			err |= clSetKernelArg(clSimulationKernel->radixScatterKernel, 4, sizeof(cl_mem),
+			                      &clSimulationKernel->radixHistograms);
+			err |= clSetKernelArg(clSimulationKernel->radixScatterKernel, 5, sizeof(chunks), &chunks);
+			err |= clSetKernelArg(clSimulationKernel->radixScatterKernel, 6, sizeof(shift), &shift);
+			if (err != CL_SUCCESS) {
+				printf("Error: Failed to set kernel arguments! %d\n", err);
+				return EXIT_FAILURE;
+			}
+
+			if (enqueueReorderKernel(clState, clSimulationKernel->radixScatterKernel, 2, chunksGlobal)
+			    != EXIT_SUCCESS) {
+				return EXIT_FAILURE;
+			}
+		}
+	}
+
+	{ // reorderParticles(particlesInput, particlesOutput, particleIds, particleIdsOutput, mortonValues[0]);
+		cl_int err = clSetKernelArg(clSimulationKernel->reorderParticlesKernel, 0, sizeof(cl_mem),
+		                            &clSimulationKernel->particlesInput);
+		err |= clSetKernelArg(clSimulationKernel->reorderParticlesKernel, 1, sizeof(cl_mem),
+		                      &clSimulationKernel->particlesOutput);
+		err |= clSetKernelArg(clSimulationKernel->reorderParticlesKernel, 2, sizeof(cl_mem),
+		                      &clSimulationKernel->particleIds);
+		err |= clSetKernelArg(clSimulationKernel->reorderParticlesKernel, 3, sizeof(cl_mem),
+		                      &clSimulationKernel->particleIdsOutput);
+		err |= clSetKernelArg(clSimulationKernel->reorderParticlesKernel, 4, sizeof(cl_mem),
+		                      &clSimulationKernel->mortonValues[0]);
+		if (err != CL_SUCCESS) {
+			printf("Error: Failed to set kernel arguments! %d\n", err);
+			return EXIT_FAILURE;
+		}
+
+		if (enqueueReorderKernel(clState, clSimulationKernel->reorderParticlesKernel, 2, particlesGlobal)
+		    != EXIT_SUCCESS) {
+			return EXIT_FAILURE;
+		}
+	}
+
+	{ // Like after an event, the sorted output becomes the input
+		const cl_mem particlesOutput = clSimulationKernel->particlesOutput;
+		clSimulationKernel->particlesOutput = clSimulationKernel->particlesInput;
+		clSimulationKernel->particlesInput = particlesOutput;
+
+		const cl_mem particleIdsOutput = clSimulationKernel->particleIdsOutput;
+		clSimulationKernel->particleIdsOutput = clSimulationKernel->particleIds;
+		clSimulationKernel->particleIds = particleIdsOutput;
+	}
+
+	{ // Wait for the command commands to get serviced before reading back results
+		clFinish(clState.commands);
+	}
+
+	return EXIT_SUCCESS;
+}
+
+// The neighbor lists of every system are built again on the next step, needed whenever particles change slots
+static int requestNeighborRebuild(struct ClState clState, struct ClSimulationKernel clSimulationKernel) {
+	const cl_uint rebuild = 1;
+	cl_int err = clEnqueueFillBuffer(clState.commands, clSimulationKernel.rebuildFlags, &rebuild, sizeof(rebuild), 0,
+	                                 sizeof(cl_uint) * clSimulationKernel.systems, 0, nullptr, nullptr);
+	if (err != CL_SUCCESS) {
+		printf("Error: Failed to request neighbor rebuild! %d\n", err);
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+static long double getTime() {
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	return (long double) now.tv_sec + (long double) now.tv_nsec * 1e-9;
+}
+
+// Waits for the last snapshot of the trace ring buffer and writes it to the file
+static int flushTrace(struct TraceWriter * traceWriter) {
+	if (!traceWriter->snapshotPending) {
+		return EXIT_SUCCESS;
+	}
+
+	cl_int err = clWaitForEvents(1, &traceWriter->snapshotEvent);
+	clReleaseEvent(traceWriter->snapshotEvent);
+	traceWriter->snapshotPending = false;
+	if (err != CL_SUCCESS) {
+		printf("Error: Failed to read trace! %d\n", err);
+		return EXIT_FAILURE;
+	}
+
+	if (!writeTraceSnapshot(traceWriter)) {
+		printf("Error: Failed to write trace!\n");
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+// Writes the previous snapshot of the trace ring buffer to the file and asynchronously takes a new one
+static int drainTrace(struct ClSimulationKernel clSimulationKernel, struct ClState clState,
+                      struct TraceWriter * traceWriter) {
+	if (flushTrace(traceWriter) != EXIT_SUCCESS) {
+		return EXIT_FAILURE;
+	}
+
+	{ // The queue is in order, so the ring is read after the last kernel and before the next step
+		cl_int err = clEnqueueReadBuffer(clState.commands, clSimulationKernel.traceCursor, CL_FALSE, 0,
+		                                 sizeof(cl_uint), &traceWriter->cursorSnapshot, 0, nullptr, nullptr);
+		err |= clEnqueueReadBuffer(clState.commands, clSimulationKernel.traceEvents, CL_FALSE, 0,
+		                           sizeof(struct TraceEvent) * traceWriter->capacity, traceWriter->ringSnapshot, 0,
+		                           nullptr, &traceWriter->snapshotEvent);
+		if (err != CL_SUCCESS) {
+			printf("Error: Failed to read trace! %d\n", err);
+			return EXIT_FAILURE;
+		}
+
+		traceWriter->snapshotPending = true;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+struct Simulation {
+	struct ClState clState;
+	struct ClSimulationKernel clSimulationKernel;
+	struct TraceWriter traceWriter;
+	struct SimulationStatistics statistics;
+
+	// Only while recording a trajectory
+	struct TrajectoryWriter trajectoryWriter;
+	cl_uint keyframeInterval;
+	struct EventRecord * eventRecords; // Host side of the event records buffer
+
+	// Timesteps and event records of every step of a batch, only while recording a trajectory
+	Time * batchTimesteps;
+	struct EventRecord * batchEventRecords;
+	cl_uint batchCapacity;
+
+	cl_uint * eventCounts; // Host side of the event counts buffer
+
+	cl_uint systems;
+	double * times; // Every system has its own simulation time
+	Time * horizons; // Host side of the horizons buffer
+	Time * timesteps; // Host side of minimumTime, how much each system advanced in the last event
+
+	// Host copy of the particles of every system, not used when the device memory is mapped in place
+	struct Particle * hostParticles;
+	// Last state read by getSimulationParticles, in slot order, nullptr when an event happened since then
+	const struct Particle * particlesView;
+
+	cl_uint reorderInterval;
+	// Once the particles are reordered, views are put back in external order using the ids
+	bool reordered;
+	cl_uint * hostIds;
+	struct Particle * orderedParticles;
+};
+
+static void subtractOutcomeCounters(const struct OutcomeCounters * a, const struct OutcomeCounters * b,
+                                    struct OutcomeCounters * result) {
+	for (uint k = 0; k < OUTCOME_COUNT; k++) {
+		result->pair[k] = a->pair[k] - b->pair[k];
+		result->wall[k] = a->wall[k] - b->wall[k];
+	}
+}
+
+// Writes the particles of a system into the input array in device memory
+static int uploadParticles(struct ClSimulationKernel * clSimulationKernel, struct ClState clState,
+                           const struct Particle * particles, cl_uint system) {
+	const size_t offset = sizeof(struct Particle) * numberParticles * system;
+
+	if (!clSimulationKernel->zeroCopy) {
+		cl_int err = clEnqueueWriteBuffer(clState.commands, clSimulationKernel->particlesInput, CL_TRUE, offset,
+		                                  sizeof(struct Particle) * numberParticles, particles, 0, nullptr,
+		                                  nullptr);
+		if (err != CL_SUCCESS) {
+			printf("Error: Failed to write to source array! %d\n", err);
+			return EXIT_FAILURE;
+		}
+
+		return EXIT_SUCCESS;
+	}
+
+	cl_int err;
+	struct Particle * mapped = clEnqueueMapBuffer(clState.commands, clSimulationKernel->particlesInput, CL_TRUE,
+	                                              CL_MAP_WRITE_INVALIDATE_REGION, offset,
+	                                              sizeof(struct Particle) * numberParticles, 0, nullptr, nullptr, &err);
+	if (err != CL_SUCCESS) {
+		printf("Error: Failed to map source array! %d\n", err);
+		return EXIT_FAILURE;
+	}
+
+	memcpy(mapped, particles, sizeof(struct Particle) * numberParticles);
+
+	err = clEnqueueUnmapMemObject(clState.commands, clSimulationKernel->particlesInput, mapped, 0, nullptr, nullptr);
+	if (err != CL_SUCCESS) {
+		printf("Error: Failed to unmap source array! %d\n", err);
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+// Makes the last simulated state of every system readable from the host, on shared memory devices it is mapped in
+// place and hostParticles is not used
+static int readParticles(struct ClSimulationKernel * clSimulationKernel, struct ClState clState,
+                         struct Particle * hostParticles, const struct Particle ** particles) {
+	if (!clSimulationKernel->zeroCopy) {
+		cl_int err = clEnqueueReadBuffer(clState.commands, clSimulationKernel->particlesInput, CL_TRUE, 0,
+		                                 sizeof(struct Particle) * numberParticles * clSimulationKernel->systems,
+		                                 hostParticles, 0, nullptr, nullptr);
+		if (err != CL_SUCCESS) {
+			printf("Error: Failed to read output array! %d\n", err);
+			return EXIT_FAILURE;
+		}
+
+		*particles = hostParticles;
+		return EXIT_SUCCESS;
+	}
+
+	cl_int err;
+	clSimulationKernel->mappedParticles = clEnqueueMapBuffer(clState.commands, clSimulationKernel->particlesInput,
+	                                                         CL_TRUE, CL_MAP_READ, 0,
+	                                                         sizeof(struct Particle) * numberParticles
+	                                                         * clSimulationKernel->systems,
+	                                                         0, nullptr, nullptr, &err);
+	if (err != CL_SUCCESS) {
+		printf("Error: Failed to map output array! %d\n", err);
+		return EXIT_FAILURE;
+	}
+
+	clSimulationKernel->mappedBuffer = clSimulationKernel->particlesInput;
+	*particles = clSimulationKernel->mappedParticles;
+	return EXIT_SUCCESS;
+}
+
+// The device must not use a buffer while the host has it mapped
+static int unmapParticles(struct ClSimulationKernel * clSimulationKernel, struct ClState clState) {
+	if (clSimulationKernel->mappedParticles == nullptr) {
+		return EXIT_SUCCESS;
+	}
+
+	cl_int err = clEnqueueUnmapMemObject(clState.commands, clSimulationKernel->mappedBuffer,
+	                                     clSimulationKernel->mappedParticles, 0, nullptr, nullptr);
+	clSimulationKernel->mappedParticles = nullptr;
+	clSimulationKernel->mappedBuffer = nullptr;
+	if (err != CL_SUCCESS) {
+		printf("Error: Failed to unmap output array! %d\n", err);
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+static int writeSimulationKeyframes(struct Simulation * simulation) {
+	for (cl_uint system = 0; system < simulation->systems; system++) {
+		const struct Particle * particles = getSimulationParticles(simulation, system);
+
+		if (particles == nullptr
+		    || !writeTrajectoryKeyframe(&simulation->trajectoryWriter, system, simulation->times[system], particles)) {
+			printf("Error: Failed to write trajectory keyframe!\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
+
+// Reorders the particles when the steps since previousIteration crossed a multiple of the reorder interval
+static int reorderIfDue(struct Simulation * simulation, cl_ulong previousIteration) {
+	struct ClSimulationKernel * clSimulationKernel = &simulation->clSimulationKernel;
+	const struct ClState clState = simulation->clState;
+	struct SimulationStatistics * statistics = &simulation->statistics;
+
+	if (simulation->reorderInterval > 0
+	    && statistics->iteration / simulation->reorderInterval != previousIteration / simulation->reorderInterval) {
+		const long double reorderStart = getTime() * 1000;
+
+		int err = callReorder(clState, clSimulationKernel);
+		err |= requestNeighborRebuild(clState, *clSimulationKernel);
+
+		if (err != EXIT_SUCCESS) {
+			return EXIT_FAILURE;
+		}
+
+		simulation->reordered = true;
+		statistics->reorders++;
+		statistics->reorderTime += getTime() * 1000 - reorderStart;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+// Enqueues the kernels of a step, nothing is read back
+static int enqueueSimulationStep(struct Simulation * simulation) {
+	struct ClSimulationKernel * clSimulationKernel = &simulation->clSimulationKernel;
+	const struct ClState clState = simulation->clState;
+
+	{ // Simulate
+		int err = callSimulation(clState, *clSimulationKernel);
+
+		if (err != EXIT_SUCCESS) {
+			return EXIT_FAILURE;
+		}
+	}
+
+	{ // The state stays on the device, the output of this event is the input of the next one
+		const cl_mem particlesOutput = clSimulationKernel->particlesOutput;
+		clSimulationKernel->particlesOutput = clSimulationKernel->particlesInput;
+		clSimulationKernel->particlesInput = particlesOutput;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+// Runs a persistent launch of events steps, the particles stay in place. The launch pads the steps after a system used
+// up its horizon, so the iteration only counts the events of the busiest system since firstIteration, read from
+// eventCounts, which waits for the launch
+static int enqueuePersistentSteps(struct Simulation * simulation, cl_uint events, cl_ulong firstIteration) {
+	struct SimulationStatistics * statistics = &simulation->statistics;
+
+	if (callPersistentSimulation(simulation->clState, simulation->clSimulationKernel, events) != EXIT_SUCCESS) {
+		return EXIT_FAILURE;
+	}
+
+	cl_int err = clEnqueueReadBuffer(simulation->clState.commands, simulation->clSimulationKernel.eventCounts, CL_TRUE,
+	                                 0, sizeof(cl_uint) * simulation->systems, simulation->eventCounts, 0, nullptr,
+	                                 nullptr);
+	if (err != CL_SUCCESS) {
+		printf("Error: Failed to read event counts! %d\n", err);
+		return EXIT_FAILURE;
+	}
+
+	cl_uint advanced = 0;
+	for (cl_uint system = 0; system < simulation->systems; system++) {
+		advanced = simulation->eventCounts[system] > advanced ? simulation->eventCounts[system] : advanced;
+	}
+
+	const cl_ulong previousIteration = statistics->iteration;
+	statistics->iteration = firstIteration + advanced;
+
+	return reorderIfDue(simulation, previousIteration);
+}
+
+// Persistent launches test all the pairs, so they are only used without neighbor lists
+static bool usePersistentSteps(const struct Simulation * simulation) {
+	return simulation->clSimulationKernel.persistentEvents > 0 && simulation->clSimulationKernel.skin == 0;
+}
+
+static int readSimulationCounters(struct Simulation * simulation) {
+	struct SimulationStatistics * statistics = &simulation->statistics;
+
+	struct OutcomeCounters outcomeTotals;
+	cl_int err = clEnqueueReadBuffer(simulation->clState.commands, simulation->clSimulationKernel.outcomeCounters,
+	                                 CL_TRUE, 0, sizeof(struct OutcomeCounters), &outcomeTotals, 0, nullptr, nullptr);
+	if (err != CL_SUCCESS) {
+		printf("Error: Failed to read outcome counters! %d\n", err);
+		return EXIT_FAILURE;
+	}
+
+	subtractOutcomeCounters(&outcomeTotals, &statistics->outcomeTotals, &statistics->outcomeInterval);
+	statistics->outcomeTotals = outcomeTotals;
+
+	err = clEnqueueReadBuffer(simulation->clState.commands, simulation->clSimulationKernel.neighborCounters, CL_TRUE, 0,
+	                          sizeof(struct NeighborCounters), &statistics->neighborTotals, 0, nullptr, nullptr);
+	if (err != CL_SUCCESS) {
+		printf("Error: Failed to read neighbor counters! %d\n", err);
+		return EXIT_FAILURE;
+	}
+
+	err = clEnqueueReadBuffer(simulation->clState.commands, simulation->clSimulationKernel.candidateCounters, CL_TRUE,
+	                          0, sizeof(struct CandidateCounters), &statistics->candidateTotals, 0, nullptr, nullptr);
+	if (err != CL_SUCCESS) {
+		printf("Error: Failed to read candidate counters! %d\n", err);
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+// Sliding window average of the time per event, iteration is the event the time belongs to
+static void addIterationTime(struct SimulationStatistics * statistics, cl_ulong iteration, long double milliseconds) {
+	const uint slidingWindowSize = 100;
+	if(iteration % slidingWindowSize == 0) {
+		statistics->iterationTimeSum = 0;
+	}
+
+	statistics->iterationTimeSum += milliseconds;
+
+	const uint valuesSinceWindowStart = iteration % slidingWindowSize + 1;
+	statistics->averageIterationTime = statistics->iterationTimeSum / valuesSinceWindowStart;
+}
+
+// Runs a single event in every system, no further than their horizons
+static int simulationStep(struct Simulation * simulation) {
+	struct ClSimulationKernel * clSimulationKernel = &simulation->clSimulationKernel;
+	const struct ClState clState = simulation->clState;
+	struct SimulationStatistics * statistics = &simulation->statistics;
+
+	const long double start = getTime() * 1000;
+
+	{ // The host may still be reading the last state in place
+		int err = unmapParticles(clSimulationKernel, clState);
+
+		if (err != EXIT_SUCCESS) {
+			return EXIT_FAILURE;
+		}
+
+		simulation->particlesView = nullptr;
+	}
+
+	{ // The host array is not touched until the timesteps are read back, after this is done
+		cl_int err = clEnqueueWriteBuffer(clState.commands, clSimulationKernel->horizons, CL_FALSE, 0,
+		                                  sizeof(Time) * simulation->systems, simulation->horizons, 0, nullptr,
+		                                  nullptr);
+		if (err != CL_SUCCESS) {
+			printf("Error: Failed to write horizons! %d\n", err);
+			return EXIT_FAILURE;
+		}
+	}
+
+	{ // Simulate
+		int err = enqueueSimulationStep(simulation);
+
+		if (err != EXIT_SUCCESS) {
+			return EXIT_FAILURE;
+		}
+
+		statistics->iteration++;
+
+		if (reorderIfDue(simulation, statistics->iteration - 1) != EXIT_SUCCESS) {
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (simulation->trajectoryWriter.file != nullptr) { // Done by the time the timesteps are read
+		cl_int err = clEnqueueReadBuffer(clState.commands, clSimulationKernel->eventRecords, CL_FALSE, 0,
+		                                 sizeof(struct EventRecord) * simulation->systems, simulation->eventRecords, 0,
+		                                 nullptr, nullptr);
+		if (err != CL_SUCCESS) {
+			printf("Error: Failed to read event records! %d\n", err);
+			return EXIT_FAILURE;
+		}
+	}
+
+	{ // Read back how long the event was in every system
+		cl_int err = clEnqueueReadBuffer(clState.commands, clSimulationKernel->minimumTime, CL_TRUE, 0,
+		                                 sizeof(Time) * simulation->systems, simulation->timesteps, 0, nullptr,
+		                                 nullptr);
+		if (err != CL_SUCCESS) {
+			printf("Error: Failed to read timesteps! %d\n", err);
+			return EXIT_FAILURE;
+		}
+
+		for (cl_uint system = 0; system < simulation->systems; system++) {
+			simulation->times[system] += simulation->timesteps[system];
+		}
+	}
+
+	if (simulation->trajectoryWriter.file != nullptr) { // Collisions happen at the end of the step
+		for (cl_uint system = 0; system < simulation->systems; system++) {
+			if (simulation->eventRecords[system].type == NONE) {
+				continue;
+			}
+
+			if (!writeTrajectoryEvent(&simulation->trajectoryWriter, system, simulation->times[system],
+			                          &simulation->eventRecords[system])) {
+				printf("Error: Failed to write trajectory!\n");
+				return EXIT_FAILURE;
+			}
+		}
+	}
+
+	if (traceLevel > TRACE_LEVEL_OFF) {
+		int err = drainTrace(*clSimulationKernel, clState, &simulation->traceWriter);
+
+		if (err != EXIT_SUCCESS) {
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (simulation->trajectoryWriter.file != nullptr && statistics->iteration % simulation->keyframeInterval == 0) {
+		if (writeSimulationKeyframes(simulation) != EXIT_SUCCESS) {
+			return EXIT_FAILURE;
+		}
+	}
+
+	const long double end = getTime() * 1000;
+
+	if (statistics->iteration % outcomeCountersInterval == 0 && readSimulationCounters(simulation) != EXIT_SUCCESS) {
+		return EXIT_FAILURE;
+	}
+
+	addIterationTime(statistics, statistics->iteration, end - start);
+
+	return EXIT_SUCCESS;
+}
+
+struct Simulation * createSimulation(bool gpu, cl_uint systems) {
+	if (systems == 0) {
+		return nullptr;
+	}
+
+	struct Simulation * simulation = calloc(1, sizeof(struct Simulation));
+	if (simulation == nullptr) {
+		return nullptr;
+	}
+
+	simulation->systems = systems;
+	simulation->times = calloc(systems, sizeof(double));
+	simulation->horizons = calloc(systems, sizeof(Time));
+	simulation->timesteps = calloc(systems, sizeof(Time));
+	simulation->hostParticles = calloc((size_t) numberParticles * systems, sizeof(struct Particle));
+	simulation->hostIds = calloc((size_t) numberParticles * systems, sizeof(cl_uint));
+	simulation->orderedParticles = calloc((size_t) numberParticles * systems, sizeof(struct Particle));
+	simulation->eventRecords = calloc(systems, sizeof(struct EventRecord));
+	simulation->eventCounts = calloc(systems, sizeof(cl_uint));
+	simulation->reorderInterval = reorderInterval;
+	if (simulation->times == nullptr || simulation->horizons == nullptr || simulation->timesteps == nullptr
+	    || simulation->hostParticles == nullptr || simulation->hostIds == nullptr
+	    || simulation->orderedParticles == nullptr || simulation->eventRecords == nullptr
+	    || simulation->eventCounts == nullptr) {
+		destroySimulation(simulation);
+		return nullptr;
+	}
+
+	simulation->clState = initClState(gpu);
+	simulation->clSimulationKernel = initSimulationKernel(simulation->clState, systems);
+
+	if (!simulation->clSimulationKernel.success
+	    || setSimulationPersistentEvents(simulation, persistentEvents) != EXIT_SUCCESS) {
+		destroySimulation(simulation);
+		return nullptr;
+	}
+
+	if (traceLevel > TRACE_LEVEL_OFF) {
+		simulation->traceWriter = openTraceWriter(traceFilePath, traceLevel, traceCapacity);
+
+		if (!simulation->traceWriter.success) {
+			destroySimulation(simulation);
+			return nullptr;
+		}
+	}
+
+	return simulation;
+}
+
+void destroySimulation(struct Simulation * simulation) {
+	if (simulation == nullptr) {
+		return;
+	}
+
+	flushTrace(&simulation->traceWriter);
+	closeTraceWriter(&simulation->traceWriter);
+	closeTrajectoryWriter(&simulation->trajectoryWriter);
+	unmapParticles(&simulation->clSimulationKernel, simulation->clState);
+	releaseClSimulationKernel(simulation->clSimulationKernel);
+	releaseClState(simulation->clState);
+
+	free(simulation->times);
+	free(simulation->horizons);
+	free(simulation->timesteps);
+	free(simulation->hostParticles);
+	free(simulation->hostIds);
+	free(simulation->orderedParticles);
+	free(simulation->eventRecords);
+	free(simulation->eventCounts);
+	free(simulation->batchTimesteps);
+	free(simulation->batchEventRecords);
+	free(simulation);
+}
+
+// Replaces the particles of the system, which is then at time
+static int writeSystemParticles(struct Simulation * simulation, cl_uint system, const struct Particle * particles,
+                                double time) {
+	if (unmapParticles(&simulation->clSimulationKernel, simulation->clState) != EXIT_SUCCESS) {
+		return EXIT_FAILURE;
+	}
+
+	simulation->particlesView = nullptr;
+	simulation->times[system] = time;
+
+	{ // The particles are stored in the given order, so every slot holds the particle with its own id
+		cl_uint * ids = simulation->hostIds + numberParticles * system;
+		for (uint i = 0; i < numberParticles; i++) {
+			ids[i] = i;
+		}
+
+		cl_int err = clEnqueueWriteBuffer(simulation->clState.commands, simulation->clSimulationKernel.particleIds,
+		                                  CL_TRUE, sizeof(cl_uint) * numberParticles * system,
+		                                  sizeof(cl_uint) * numberParticles, ids, 0, nullptr, nullptr);
+		if (err != CL_SUCCESS) {
+			printf("Error: Failed to write particle ids! %d\n", err);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (requestNeighborRebuild(simulation->clState, simulation->clSimulationKernel) != EXIT_SUCCESS) {
+		return EXIT_FAILURE;
+	}
+
+	if (simulation->trajectoryWriter.file != nullptr
+	    && !writeTrajectoryKeyframe(&simulation->trajectoryWriter, system, time, particles)) {
+		printf("Error: Failed to write trajectory keyframe!\n");
+		return EXIT_FAILURE;
+	}
+
+	return uploadParticles(&simulation->clSimulationKernel, simulation->clState, particles, system);
+}
+
+int setSimulationParticles(struct Simulation * simulation, cl_uint system, const struct Particle * particles,
+                           cl_uint count) {
+	if (count != numberParticles) {
+		printf("Error: The simulation is built for %u particles, got %u!\n", numberParticles, count);
+		return EXIT_FAILURE;
+	}
+
+	if (system >= simulation->systems) {
+		printf("Error: There is no system %u!\n", system);
+		return EXIT_FAILURE;
+	}
+
+	return writeSystemParticles(simulation, system, particles, 0);
+}
+
+int loadSimulationInitialConditions(struct Simulation * simulation, unsigned int seed) {
+	for (cl_uint system = 0; system < simulation->systems; system++) {
+		srand(seed + system);
+
+		struct Particle * particles = simulation->hostParticles + numberParticles * system;
+		for (uint i = 0; i < numberParticles; i++) {
+			particles[i].position = generatePosition();
+			particles[i].velocity = generateVelocity();
+		}
+
+		if (setSimulationParticles(simulation, system, particles, numberParticles) != EXIT_SUCCESS) {
+			return EXIT_FAILURE;
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
+
+int advanceSimulationOptimistic(struct Simulation * simulation, cl_uint system, double time, cl_uint workers) {
+	if (system >= simulation->systems) {
+		printf("Error: There is no system %u!\n", system);
+		return EXIT_FAILURE;
+	}
+
+	const double start = simulation->times[system];
+	if (time <= start) {
+		return EXIT_SUCCESS;
+	}
+
+	const struct Particle * particles = getSimulationParticles(simulation, system);
+	if (particles == nullptr) {
+		return EXIT_FAILURE;
+	}
+
+	// The engine starts at 0, the collisions do not depend on where time starts
+	struct OptimisticEngine engine = initOptimisticEngine(particles, numberParticles,
+	                                                      (cl_float2) { .x = (cl_float) width, .y = (cl_float) height },
+	                                                      workers, optimisticSpeculation);
+	if (!engine.success || advanceOptimisticEngine(&engine, time - start) != EXIT_SUCCESS) {
+		releaseOptimisticEngine(engine);
+		return EXIT_FAILURE;
+	}
+
+	// The engine has its own copy, so the read back particles can be overwritten
+	struct Particle * advanced = simulation->hostParticles + numberParticles * system;
+	getOptimisticParticles(&engine, advanced);
+	releaseOptimisticEngine(engine);
+
+	return writeSystemParticles(simulation, system, advanced, time);
+}
+
+// Runs up to maxEvents steps of every system with the horizons already set, which are consumed on the device
+// Reads what is left of every horizon into timesteps, which waits for the steps enqueued so far, done is set when
+// every system reached the end of the batch. findMin takes the whole horizon as the last step, so it ends at 0
+static int batchDone(struct Simulation * simulation, bool * done) {
+	cl_int err = clEnqueueReadBuffer(simulation->clState.commands, simulation->clSimulationKernel.horizons, CL_TRUE, 0,
+	                                 sizeof(Time) * simulation->systems, simulation->timesteps, 0, nullptr, nullptr);
+	if (err != CL_SUCCESS) {
+		printf("Error: Failed to read horizons! %d\n", err);
+		return EXIT_FAILURE;
+	}
+
+	*done = true;
+	for (cl_uint system = 0; system < simulation->systems; system++) {
+		*done &= simulation->timesteps[system] <= 0;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+static int simulationBatch(struct Simulation * simulation, cl_uint maxEvents, cl_uint * events) {
+	struct ClSimulationKernel * clSimulationKernel = &simulation->clSimulationKernel;
+	const struct ClState clState = simulation->clState;
+	struct SimulationStatistics * statistics = &simulation->statistics;
+	const bool recording = simulation->trajectoryWriter.file != nullptr;
+
+	*events = 0;
+
+	if (recording && simulation->batchCapacity < maxEvents) {
+		Time * timesteps = realloc(simulation->batchTimesteps, sizeof(Time) * maxEvents * simulation->systems);
+		if (timesteps != nullptr) {
+			simulation->batchTimesteps = timesteps;
+		}
+		struct EventRecord * eventRecords = realloc(simulation->batchEventRecords,
+		                                            sizeof(struct EventRecord) * maxEvents * simulation->systems);
+		if (eventRecords != nullptr) {
+			simulation->batchEventRecords = eventRecords;
+		}
+		if (timesteps == nullptr || eventRecords == nullptr) {
+			printf("Error: Failed to allocate batch records!\n");
+			return EXIT_FAILURE;
+		}
+
+		simulation->batchCapacity = maxEvents;
+	}
+
+	const long double start = getTime() * 1000;
+	const cl_ulong firstIteration = statistics->iteration;
+
+	{ // The host may still be reading the last state in place
+		int err = unmapParticles(clSimulationKernel, clState);
+
+		if (err != EXIT_SUCCESS) {
+			return EXIT_FAILURE;
+		}
+
+		simulation->particlesView = nullptr;
+	}
+
+	{ // The horizons are kept in the host array, the remaining time is read into timesteps
+		const cl_uint zero = 0;
+		cl_int err = clEnqueueWriteBuffer(clState.commands, clSimulationKernel->horizons, CL_FALSE, 0,
+		                                  sizeof(Time) * simulation->systems, simulation->horizons, 0, nullptr,
+		                                  nullptr);
+		err |= clEnqueueFillBuffer(clState.commands, clSimulationKernel->eventCounts, &zero, sizeof(zero), 0,
+		                           sizeof(cl_uint) * simulation->systems, 0, nullptr, nullptr);
+		if (err != CL_SUCCESS) {
+			printf("Error: Failed to write horizons! %d\n", err);
+			return EXIT_FAILURE;
+		}
+	}
+
+	// Steps with a slot in the batch records
+	cl_uint launchedSteps = 0;
+
+	for (cl_uint step = 0; step < maxEvents && usePersistentSteps(simulation);) {
+		const cl_uint launchEvents = maxEvents - step < clSimulationKernel->persistentEvents ?
+			maxEvents - step : clSimulationKernel->persistentEvents;
+
+		if (enqueuePersistentSteps(simulation, launchEvents, firstIteration) != EXIT_SUCCESS) {
+			return EXIT_FAILURE;
+		}
+
+		if (recording) { // The launch wrote every step, laid out as the batch records
+			cl_int err = clEnqueueReadBuffer(clState.commands, clSimulationKernel->persistentTimesteps, CL_FALSE, 0,
+			                                 sizeof(Time) * launchEvents * simulation->systems,
+			                                 simulation->batchTimesteps + step * simulation->systems, 0, nullptr,
+			                                 nullptr);
+			err |= clEnqueueReadBuffer(clState.commands, clSimulationKernel->persistentEventRecords, CL_FALSE, 0,
+			                           sizeof(struct EventRecord) * launchEvents * simulation->systems,
+			                           simulation->batchEventRecords + step * simulation->systems, 0, nullptr,
+			                           nullptr);
+			if (err != CL_SUCCESS) {
+				printf("Error: Failed to read event records! %d\n", err);
+				return EXIT_FAILURE;
+			}
+
+			// The next launch overwrites the results
+			err = clFinish(clState.commands);
+			if (err != CL_SUCCESS) {
+				printf("Error: Failed to read event records! %d\n", err);
+				return EXIT_FAILURE;
+			}
+		}
+
+		step += launchEvents;
+		launchedSteps = step;
+
+		// The next launches would only pad. Not from the event counts, a zero timestep does not count as an event
+		if (step < maxEvents) {
+			bool done;
+			if (batchDone(simulation, &done) != EXIT_SUCCESS) {
+				return EXIT_FAILURE;
+			}
+
+			if (done) {
+				break;
+			}
+		}
+	}
+
+	for (cl_uint step = 0; step < maxEvents && !usePersistentSteps(simulation); step++) {
+		if (enqueueSimulationStep(simulation) != EXIT_SUCCESS) {
+			return EXIT_FAILURE;
+		}
+		launchedSteps = step + 1;
+
+		if (recording) { // Only copies, the host only waits to check the horizons
+			cl_int err = clEnqueueReadBuffer(clState.commands, clSimulationKernel->minimumTime, CL_FALSE, 0,
+			                                 sizeof(Time) * simulation->systems,
+			                                 simulation->batchTimesteps + step * simulation->systems, 0, nullptr,
+			                                 nullptr);
+			err |= clEnqueueReadBuffer(clState.commands, clSimulationKernel->eventRecords, CL_FALSE, 0,
+			                           sizeof(struct EventRecord) * simulation->systems,
+			                           simulation->batchEventRecords + step * simulation->systems, 0, nullptr,
+			                           nullptr);
+			if (err != CL_SUCCESS) {
+				printf("Error: Failed to read event records! %d\n", err);
+				return EXIT_FAILURE;
+			}
+		}
+
+		// The steps left would only idle
+		if (launchedSteps % batchCheckInterval == 0 && launchedSteps < maxEvents) {
+			bool done;
+			if (batchDone(simulation, &done) != EXIT_SUCCESS) {
+				return EXIT_FAILURE;
+			}
+
+			if (done) {
+				break;
+			}
+		}
+	}
+
+	{ // Read back what is left of every horizon and how many steps advanced each system
+		cl_int err = clEnqueueReadBuffer(clState.commands, clSimulationKernel->eventCounts, CL_FALSE, 0,
+		                                 sizeof(cl_uint) * simulation->systems, simulation->eventCounts, 0, nullptr,
+		                                 nullptr);
+		err |= clEnqueueReadBuffer(clState.commands, clSimulationKernel->horizons, CL_TRUE, 0,
+		                           sizeof(Time) * simulation->systems, simulation->timesteps, 0, nullptr, nullptr);
+		if (err != CL_SUCCESS) {
+			printf("Error: Failed to read horizons! %d\n", err);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (recording) { // Same as simulationStep, one step at a time
+		for (cl_uint step = 0; step < launchedSteps; step++) {
+			for (cl_uint system = 0; system < simulation->systems; system++) {
+				const struct EventRecord * eventRecord = &simulation->batchEventRecords[step * simulation->systems
+				                                                                        + system];
+
+				simulation->times[system] += simulation->batchTimesteps[step * simulation->systems + system];
+
+				if (eventRecord->type != NONE
+				    && !writeTrajectoryEvent(&simulation->trajectoryWriter, system, simulation->times[system],
+				                             eventRecord)) {
+					printf("Error: Failed to write trajectory!\n");
+					return EXIT_FAILURE;
+				}
+			}
+		}
+	} else {
+		for (cl_uint system = 0; system < simulation->systems; system++) {
+			simulation->times[system] += simulation->horizons[system] - simulation->timesteps[system];
+		}
+	}
+
+	for (cl_uint system = 0; system < simulation->systems; system++) {
+		*events = simulation->eventCounts[system] > *events ? simulation->eventCounts[system] : *events;
+	}
+
+	// Only the events of the busiest system count, the steps launched after it reached its horizon did nothing. The
+	// device cannot tell when that happened without a wait, so the steps of a batch reorder once at its end, persistent
+	// launches already did after each one
+	statistics->iteration = firstIteration + *events;
+
+	if (!usePersistentSteps(simulation) && reorderIfDue(simulation, firstIteration) != EXIT_SUCCESS) {
+		return EXIT_FAILURE;
+	}
+
+	if (traceLevel > TRACE_LEVEL_OFF) {
+		int err = drainTrace(*clSimulationKernel, clState, &simulation->traceWriter);
+
+		if (err != EXIT_SUCCESS) {
+			return EXIT_FAILURE;
+		}
+	}
+
+	// Keyframes can only be taken at the end of the batch
+	if (recording && statistics->iteration / simulation->keyframeInterval
+	                 != firstIteration / simulation->keyframeInterval) {
+		if (writeSimulationKeyframes(simulation) != EXIT_SUCCESS) {
+			return EXIT_FAILURE;
+		}
+	}
+
+	const long double end = getTime() * 1000;
+
+	if (statistics->iteration / outcomeCountersInterval != firstIteration / outcomeCountersInterval
+	    && readSimulationCounters(simulation) != EXIT_SUCCESS) {
+		return EXIT_FAILURE;
+	}
+
+	for (cl_ulong iteration = firstIteration + 1; iteration <= statistics->iteration; iteration++) {
+		addIterationTime(statistics, iteration, (end - start) / *events);
+	}
+
+	return EXIT_SUCCESS;
+}
+
+int advanceSimulationEvents(struct Simulation * simulation, cl_uint events) {
+	if (usePersistentSteps(simulation) && events > 0) {
+		// Every step is still no longer than dt, the horizon only has to outlast all of them
+		for (cl_uint system = 0; system < simulation->systems; system++) {
+			simulation->horizons[system] = dt * (Time) events;
+		}
+
+		cl_uint advanced;
+		return simulationBatch(simulation, events, &advanced);
+	}
+
+	for (cl_uint system = 0; system < simulation->systems; system++) {
+		simulation->horizons[system] = dt;
+	}
+
+	for (cl_uint event = 0; event < events; event++) {
+		if (simulationStep(simulation) != EXIT_SUCCESS) {
+			return EXIT_FAILURE;
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
+
+// Sets the horizon of every system to what is left until time, no more than limit, false when every system is there
+static bool setHorizonsUntil(struct Simulation * simulation, double time, double limit) {
+	bool done = true;
+
+	for (cl_uint system = 0; system < simulation->systems; system++) {
+		// Anything closer than what a float timestep can represent is already there, a horizon of 0 leaves the
+		// system as it is
+		const double remaining = time - simulation->times[system];
+		if (remaining <= FLT_EPSILON * fmax(1, fabs(time))) {
+			simulation->horizons[system] = 0;
+			continue;
+		}
+
+		simulation->horizons[system] = (Time) fmin(limit, remaining);
+		done = false;
+	}
+
+	return !done;
+}
+
+int advanceSimulationUntil(struct Simulation * simulation, double time) {
+	while (true) {
+		const bool done = !setHorizonsUntil(simulation, time, dt);
+
+		if (done) {
+			return EXIT_SUCCESS;
+		}
+
+		if (simulationStep(simulation) != EXIT_SUCCESS) {
+			return EXIT_FAILURE;
+		}
+	}
+}
+
+int advanceSimulationBatch(struct Simulation * simulation, double time, cl_uint maxEvents, cl_uint * events) {
+	*events = 0;
+
+	// The horizons are consumed on the device, every system stops at time on its own
+	if (!setHorizonsUntil(simulation, time, INFINITY) || maxEvents == 0) {
+		return EXIT_SUCCESS;
+	}
+
+	return simulationBatch(simulation, maxEvents, events);
+}
+
+const struct Particle * getSimulationParticles(struct Simulation * simulation, cl_uint system) {
+	if (system >= simulation->systems) {
+		return nullptr;
+	}
+
+	if (simulation->particlesView == nullptr
+	    && readParticles(&simulation->clSimulationKernel, simulation->clState, simulation->hostParticles,
+	                     &simulation->particlesView) != EXIT_SUCCESS) {
+		simulation->particlesView = nullptr;
+		return nullptr;
+	}
+
+	if (!simulation->reordered) {
+		return simulation->particlesView + numberParticles * system;
+	}
+
+	{ // Put the particles back in the order they were given in
+		const size_t first = numberParticles * system;
+
+		cl_int err = clEnqueueReadBuffer(simulation->clState.commands, simulation->clSimulationKernel.particleIds,
+		                                 CL_TRUE, sizeof(cl_uint) * first, sizeof(cl_uint) * numberParticles,
+		                                 simulation->hostIds + first, 0, nullptr, nullptr);
+		if (err != CL_SUCCESS) {
+			printf("Error: Failed to read particle ids! %d\n", err);
+			return nullptr;
+		}
+
+		for (uint k = 0; k < numberParticles; k++) {
+			simulation->orderedParticles[first + simulation->hostIds[first + k]] = simulation->particlesView[first + k];
+		}
+
+		return simulation->orderedParticles + first;
+	}
+}
+
+int recordSimulationTrajectory(struct Simulation * simulation, const char * path, cl_uint keyframeInterval) {
+	if (keyframeInterval == 0) {
+		printf("Error: The keyframe interval must be at least 1!\n");
+		return EXIT_FAILURE;
+	}
+
+	if (stopSimulationTrajectory(simulation) != EXIT_SUCCESS) {
+		return EXIT_FAILURE;
+	}
+
+	simulation->trajectoryWriter = openTrajectoryWriter(path, simulation->systems, numberParticles);
+	simulation->keyframeInterval = keyframeInterval;
+
+	if (!simulation->trajectoryWriter.success) {
+		closeTrajectoryWriter(&simulation->trajectoryWriter);
+		return EXIT_FAILURE;
+	}
+
+	return writeSimulationKeyframes(simulation);
+}
+
+int stopSimulationTrajectory(struct Simulation * simulation) {
+	if (simulation->trajectoryWriter.file == nullptr) {
+		return EXIT_SUCCESS;
+	}
+
+	if (!closeTrajectoryWriter(&simulation->trajectoryWriter)) {
+		printf("Error: Failed to close trajectory!\n");
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+void setSimulationReorderInterval(struct Simulation * simulation, cl_uint interval) {
+	simulation->reorderInterval = interval;
+}
+
+int setSimulationPersistentEvents(struct Simulation * simulation, cl_uint events) {
+	if (events == simulation->clSimulationKernel.persistentEvents) {
+		return EXIT_SUCCESS;
+	}
+
+	// The results of the last launch may still be read
+	clFinish(simulation->clState.commands);
+
+	return allocatePersistentResults(simulation->clState, &simulation->clSimulationKernel, events);
+}
+
+int setSimulationFusedIntersectionTime(struct Simulation * simulation, bool fused) {
+	if (fused == simulation->clSimulationKernel.fused) {
+		return EXIT_SUCCESS;
+	}
+
+	// The last step may still use the buffers
+	clFinish(simulation->clState.commands);
+
+	simulation->clSimulationKernel.fused = fused;
+	return allocatePairTimes(simulation->clState, &simulation->clSimulationKernel);
+}
+
+int setSimulationNeighborSkin(struct Simulation * simulation, cl_float skin) {
+	simulation->clSimulationKernel.skin = skin;
+
+	return requestNeighborRebuild(simulation->clState, simulation->clSimulationKernel);
+}
+
+double getSimulationLocality(struct Simulation * simulation) {
+	if (simulation->particlesView == nullptr
+	    && readParticles(&simulation->clSimulationKernel, simulation->clState, simulation->hostParticles,
+	                     &simulation->particlesView) != EXIT_SUCCESS) {
+		simulation->particlesView = nullptr;
+		return -1;
+	}
+
+	double distanceSum = 0;
+	for (cl_uint system = 0; system < simulation->systems; system++) {
+		const struct Particle * particles = simulation->particlesView + numberParticles * system;
+
+		for (uint k = 1; k < numberParticles; k++) {
+			distanceSum += hypot(particles[k].position.x - particles[k - 1].position.x,
+			                     particles[k].position.y - particles[k - 1].position.y);
+		}
+	}
+
+	return numberParticles < 2 ? 0 : distanceSum / ((double) (numberParticles - 1) * simulation->systems);
+}
+
+cl_uint getSimulationSystems(const struct Simulation * simulation) {
+	return simulation->systems;
+}
+
+cl_uint getSimulationPairVectorWidth(const struct Simulation * simulation) {
+	return simulation->clState.pairVectorWidth;
+}
+
+bool getSimulationFusedIntersectionTime(const struct Simulation * simulation) {
+	return simulation->clSimulationKernel.fused;
+}
+
+cl_uint getSimulationReorderInterval(const struct Simulation * simulation) {
+	return simulation->reorderInterval;
+}
+
+cl_float getSimulationNeighborSkin(const struct Simulation * simulation) {
+	return simulation->clSimulationKernel.skin;
+}
+
+cl_uint getSimulationPersistentEvents(const struct Simulation * simulation) {
+	return simulation->clSimulationKernel.persistentEvents;
+}
+
+double getSimulationTime(const struct Simulation * simulation, cl_uint system) {
+	return simulation->times[system];
+}
+
+struct SimulationStatistics getSimulationStatistics(const struct Simulation * simulation) {
+	return simulation->statistics;
+}
@@ -0,0 +1,107 @@
+#ifndef COLLISIONBASEDGASSIMULATOR_SIMULATION_H
+#define COLLISIONBASEDGASSIMULATOR_SIMULATION_H
+
+#include <stdbool.h>
+
+#define CL_TARGET_OPENCL_VERSION 300
+#include <CL/cl.h>
+
+#include "datatypes.h"
+
+// Opaque handle to a simulation, the whole state lives on the OpenCL device. A simulation is an ensemble of
+// independent systems of numberParticles particles each, advanced together by every kernel launch
+struct Simulation;
+
+struct SimulationStatistics {
+	cl_ulong iteration; // Events simulated so far by every system
+	long double iterationTimeSum;
+	long double averageIterationTime; // Milliseconds per event over a sliding window
+
+	struct OutcomeCounters outcomeTotals; // Last values read from the device
+	struct OutcomeCounters outcomeInterval; // Outcomes during the last outcomeCountersInterval events
+
+	cl_ulong reorders; // Morton reorders of the particle buffers so far
+	long double reorderTime; // Milliseconds spent reordering, not part of the iteration time
+
+	struct NeighborCounters neighborTotals; // Last values read from the device, with the outcome counters
+	struct CandidateCounters candidateTotals; // Same
+};
+
+// Returns nullptr on failure
+struct Simulation * createSimulation(bool gpu, cl_uint systems);
+
+void destroySimulation(struct Simulation * simulation);
+
+// count must be numberParticles, simulation time of the system is reset to 0
+int setSimulationParticles(struct Simulation * simulation, cl_uint system, const struct Particle * particles,
+                           cl_uint count);
+
+// Random positions and velocities of the same length, system s is generated from seed + s
+int loadSimulationInitialConditions(struct Simulation * simulation, unsigned int seed);
+
+// Each system runs its own next event, which is either its next collision or a free flight of dt, the particles are
+// not read back to the host in between events
+int advanceSimulationEvents(struct Simulation * simulation, cl_uint events);
+
+// Runs events until the simulation time of every system reaches time, the last event of each system is cut short to
+// land on it exactly
+int advanceSimulationUntil(struct Simulation * simulation, double time);
+
+// Enqueues up to maxEvents events of every system, every system stops at time on the device and idles until the others
+// do. Only the horizons are read back, every few steps, and the batch ends once every system reached time. events is
+// set to the events the busiest system needed, when it equals maxEvents some system may not have reached time
+int advanceSimulationBatch(struct Simulation * simulation, double time, cl_uint maxEvents, cl_uint * events);
+
+// Advances one system to time on the host with the Time Warp engine of optimistic.h, workers threads simulate strips
+// of the box in parallel. For systems too large to be fast on the device, the particles are read back and written
+// again with the system at time, a trajectory being recorded gets a keyframe there
+int advanceSimulationOptimistic(struct Simulation * simulation, cl_uint system, double time, cl_uint workers);
+
+// The state of a system after the last event, in the order the particles were given in, valid until the next call
+// that changes the simulation, nullptr on failure
+const struct Particle * getSimulationParticles(struct Simulation * simulation, cl_uint system);
+
+// Writes the collisions of every system to a trajectory file from now on, with keyframes of every system every
+// keyframeInterval events, see trajectory.h. A trajectory being recorded is replaced
+int recordSimulationTrajectory(struct Simulation * simulation, const char * path, cl_uint keyframeInterval);
+
+// Closes the trajectory file, nothing happens when there is none
+int stopSimulationTrajectory(struct Simulation * simulation);
+
+// Every interval events the particle buffers are sorted along a Morton curve, so particles close in space are close
+// in memory, 0 disables it. Reordering does not change the ids particles are returned with
+void setSimulationReorderInterval(struct Simulation * simulation, cl_uint interval);
+
+// With a skin larger than 0 every particle only tests the partners closer than 2 * radius + skin when its list was
+// built, the lists are built again when a particle could have moved half the skin. 0 tests every pair
+int setSimulationNeighborSkin(struct Simulation * simulation, cl_float skin);
+
+// Runs up to events steps of every system in a single kernel launch that loops on the device, instead of launching
+// the kernels of every step from the host. 0 disables it. Not used while there are neighbor lists
+int setSimulationPersistentEvents(struct Simulation * simulation, cl_uint events);
+
+// Computes and reduces the pair times in one kernel when true, false writes them to the numberParticles² matrix
+// first, which is then reduced from the compacted candidates or walked whole. Both give the same events
+int setSimulationFusedIntersectionTime(struct Simulation * simulation, bool fused);
+
+// Mean distance between particles in consecutive slots of the device buffers, lower is better, negative on failure
+double getSimulationLocality(struct Simulation * simulation);
+
+cl_uint getSimulationSystems(const struct Simulation * simulation);
+
+// Partners every work item of the pair kernels tests at once, picked from the device when the kernels are built
+cl_uint getSimulationPairVectorWidth(const struct Simulation * simulation);
+
+// True when the pair times are reduced as they are computed, false when they go through the matrix
+bool getSimulationFusedIntersectionTime(const struct Simulation * simulation);
+
+// Defaults until changed by the setters
+cl_uint getSimulationReorderInterval(const struct Simulation * simulation);
+cl_float getSimulationNeighborSkin(const struct Simulation * simulation);
+cl_uint getSimulationPersistentEvents(const struct Simulation * simulation);
+
+double getSimulationTime(const struct Simulation * simulation, cl_uint system);
+
+struct SimulationStatistics getSimulationStatistics(const struct Simulation * simulation);
+
+#endif //COLLISIONBASEDGASSIMULATOR_SIMULATION_H
@@ -1,15 +1,18 @@
-#define DEBUG true
-#if DEBUG
-#define PRINT_DEBUG(...) printf(__VA_ARGS__)
-#else
-#define PRINT_DEBUG(...) (void) 0
+// TRACE_LEVEL and TRACE_CAPACITY are set by the host when building the program (see traceLevel in configuration.h)
+#ifndef TRACE_LEVEL
+#define TRACE_LEVEL 0
 #endif
+#define TRACE_LEVEL_EVENTS 1
+#define TRACE_LEVEL_TESTS 2
 
 constant const uint width = 500;
 constant const uint height = 500;
 
 constant const uint numberParticles = 20;
 
+// Independent systems are simulated side by side, every buffer holds them back to back and the last dimension of
+// every kernel is the system
+
 constant const float radius = 20;
 constant const float dt = 0.5f;
 
@@ -36,27 +39,152 @@ struct __attribute__((packed)) Collision {
 	uint indexB;
 };
 
-kernel void calculateIntersectionTime(global const struct Particle* particlesInput,
-                                      global Time * const intersectionTimes) {
-	const uint i = get_global_id(0);
-	const float2 pointA = particlesInput[i].position;
-	const float2 velocityA = particlesInput[i].velocity;
+// findMin clears the record of every system and advanceSimulation fills it when the event is a collision
+struct __attribute__((packed)) EventRecord {
+	uint type;
+	uint indexA;
+	uint indexB;
+	float2 velocityA;
+	float2 velocityB;
+};
 
-	const uint j = get_global_id(1);
-	const float2 pointB = particlesInput[j].position;
-	const float2 velocityB = particlesInput[j].velocity;
+// All the trace definitions here must also be in trace.h
+
+enum TraceEventType {
+	TRACE_OVERLAP = 0,
+	TRACE_NO_INTERSECT,
+	TRACE_GLANCING,
+	TRACE_GETTING_FARTHER,
+	TRACE_COLLISION,
+	TRACE_WALL_NO_INTERSECT,
+	TRACE_WALL_GLANCING,
+	TRACE_WALL_GETTING_FARTHER,
+	TRACE_WALL_COLLISION,
+	TRACE_PARTICLE_PARTICLE,
+	TRACE_PARTICLE_WALL_X,
+	TRACE_PARTICLE_WALL_Y,
+	TRACE_COLLISION_ERROR,
+	TRACE_ZERO_TIMESTEP,
+	TRACE_DROPPED
+};
+
+struct __attribute__((packed)) TraceEvent {
+	uint type;
+	uint indexA;
+	uint indexB;
+	float value;
+};
+
+#if TRACE_LEVEL > 0
+// The cursor wraps at 2^32, only a power of two keeps the slots in order across it
+#if (TRACE_CAPACITY & (TRACE_CAPACITY - 1)) != 0
+#error TRACE_CAPACITY must be a power of two
+#endif
+
+#define TRACE_PARAMETERS , global struct TraceEvent * const traceEvents, global uint * const traceCursor
+#define TRACE_ARGUMENTS , traceEvents, traceCursor
+// No line continuations here, generate_kernels.sh would break them
+#define TRACE(level, type, indexA, indexB, value) do { if (TRACE_LEVEL >= (level)) trace(traceEvents, traceCursor, (type), (indexA), (indexB), (value)); } while (0)
+
+// Appends an event to the ring buffer, the host drains it after every step
+void trace(global struct TraceEvent * const traceEvents, global uint * const traceCursor,
+           const enum TraceEventType type, const uint indexA, const uint indexB, const float value) {
+	const uint slot = atomic_inc(traceCursor) % TRACE_CAPACITY;
+
+	traceEvents[slot].type = type;
+	traceEvents[slot].indexA = indexA;
+	traceEvents[slot].indexB = indexB;
+	traceEvents[slot].value = value;
+}
+#else
+#define TRACE_PARAMETERS
+#define TRACE_ARGUMENTS
+#define TRACE(level, type, indexA, indexB, value) (void) 0
+#endif
+
+// Every pair and wall test ends in one of these, pairs are counted in the first OUTCOME_COUNT entries of the
+// outcome counters and walls in the next OUTCOME_COUNT entries
+enum Outcome {
+	OUTCOME_OVERLAP = 0,
+	OUTCOME_NO_INTERSECT,
+	OUTCOME_GLANCING,
+	OUTCOME_GETTING_FARTHER,
+	OUTCOME_COLLISION,
+	OUTCOME_COUNT
+};
+
+constant const uint wallOutcomesOffset = OUTCOME_COUNT;
 
-	if (i == j || i < j) {
-		return;
+// Neighbor lists, with a skin larger than 0 only the pairs closer than 2 * radius + skin when the lists were built are
+// tested. Lists hold the partners with a lower index, so every pair is tested once
+
+constant const uint maxNeighbors = 32;
+
+// Count of a list that did not fit in maxNeighbors, no partner is ever dropped: until the next build the particle tests
+// every particle before it, as without lists
+#define NEIGHBOR_LIST_FULL 0xFFFFFFFF
+
+// Partners of particle i and the k-th of them, neighbors and neighborCounts are those of its system
+uint neighborPartners(global const uint * neighborCounts, const uint i) {
+    return neighborCounts[i] == NEIGHBOR_LIST_FULL ? i : neighborCounts[i];
+}
+
+uint neighborPartner(global const uint * neighbors, global const uint * neighborCounts, const uint i, const uint k) {
+    return neighborCounts[i] == NEIGHBOR_LIST_FULL ? k : neighbors[i * maxNeighbors + k];
+}
+
+// Entries of the neighbor counters, must match struct NeighborCounters in datatypes.h
+enum NeighborCounter {
+    NEIGHBOR_REBUILDS = 0,
+    NEIGHBOR_OVERFLOWS,
+    NEIGHBOR_ENTRIES
+};
+
+// Entries of the candidate counters, must match struct CandidateCounters in datatypes.h
+enum CandidateCounter {
+    CANDIDATE_STEPS = 0,
+    CANDIDATE_ENTRIES,
+    CANDIDATE_OVERFLOWS
+};
+
+uint localLinearId() {
+	return (get_local_id(2) * get_local_size(1) + get_local_id(1)) * get_local_size(0) + get_local_id(0);
+}
+
+uint localLinearSize() {
+	return get_local_size(0) * get_local_size(1) * get_local_size(2);
+}
+
+// The work group counts in local memory and only then merges into the global counters
+void clearLocalOutcomeCounters(local uint * const localCounters) {
+	const uint localIndex = localLinearId();
+	const uint localSize = localLinearSize();
+
+	for (uint k = localIndex; k < 2 * OUTCOME_COUNT; k += localSize) {
+		localCounters[k] = 0;
 	}
+}
+
+void mergeLocalOutcomeCounters(local const uint * const localCounters, global uint * const outcomeCounters) {
+	const uint localIndex = localLinearId();
+	const uint localSize = localLinearSize();
+
+	for (uint k = localIndex; k < 2 * OUTCOME_COUNT; k += localSize) {
+		if (localCounters[k] != 0) {
+			atomic_add(&outcomeCounters[k], localCounters[k]);
+		}
+	}
+}
 
-	intersectionTimes[i * numberParticles + j] = INFINITY;
+enum Outcome particleParticleIntersectionTime(const uint i, const float2 pointA, const float2 velocityA,
+                                              const uint j, const float2 pointB, const float2 velocityB,
+                                              Time * const collisionTime TRACE_PARAMETERS) {
+	*collisionTime = INFINITY;
 
 	if (hypot(pointA.x - pointB.x, pointA.y - pointB.y) <= 2 * radius) {
 		//TODO fix this on point generation
-		PRINT_DEBUG("Overlap: %d((%f, %f), (%f, %f)) and %d((%f, %f), (%f, %f))\n", i, pointA.x, pointA.y,
-		       velocityA.x, velocityA.y, j, pointB.x, pointB.y, velocityB.x, velocityB.y);
-		return;
+		TRACE(TRACE_LEVEL_TESTS, TRACE_OVERLAP, i, j, hypot(pointA.x - pointB.x, pointA.y - pointB.y));
+		return OUTCOME_OVERLAP;
 	}
 
 	const float a = pow(velocityA.x - velocityB.x, 2) + pow(velocityA.y - velocityB.y, 2);
@@ -66,102 +194,394 @@ kernel void calculateIntersectionTime(global const struct Particle* particlesInp
 	const float d = pow(b, 2) - 4 * a * c;
 
 	if (d < 0) {
-		PRINT_DEBUG("No intersect: %d((%f, %f), (%f, %f)) and %d((%f, %f), (%f, %f))\n", i, pointA.x, pointA.y,
-		       velocityA.x, velocityA.y, j, pointB.x, pointB.y, velocityB.x, velocityB.y);
-		return;
+		TRACE(TRACE_LEVEL_TESTS, TRACE_NO_INTERSECT, i, j, d);
+		return OUTCOME_NO_INTERSECT;
 	}
 	if (b > epsilon) {
-		PRINT_DEBUG("Glancing: %d((%f, %f), (%f, %f)) and %d((%f, %f), (%f, %f))\n", i, pointA.x, pointA.y,
-		       velocityA.x, velocityA.y, j, pointB.x, pointB.y, velocityB.x, velocityB.y);
-		return;
+		TRACE(TRACE_LEVEL_TESTS, TRACE_GLANCING, i, j, b);
+		return OUTCOME_GLANCING;
 	}
 
 	const Time t0 = (-b + sqrt(d)) / (2 * a);
 	const Time t1 = (-b - sqrt(d)) / (2 * a);
 
 	if (b >= 0) {
-		PRINT_DEBUG("Getting farther: %d((%f, %f), (%f, %f)) and %d((%f, %f), (%f, %f))\n", i, pointA.x, pointA.y,
-		       velocityA.x, velocityA.y, j, pointB.x, pointB.y, velocityB.x, velocityB.y);
-		return;
+		TRACE(TRACE_LEVEL_TESTS, TRACE_GETTING_FARTHER, i, j, b);
+		return OUTCOME_GETTING_FARTHER;
 	}
 	if (t0 < 0 && t1 > 0 && b <= epsilon) {
-		PRINT_DEBUG("No intersect: %d((%f, %f), (%f, %f)) and %d((%f, %f), (%f, %f))\n", i, pointA.x, pointA.y,
-		       velocityA.x, velocityA.y, j, pointB.x, pointB.y, velocityB.x, velocityB.y);
-		return;
+		TRACE(TRACE_LEVEL_TESTS, TRACE_NO_INTERSECT, i, j, d);
+		return OUTCOME_NO_INTERSECT;
 	}
 
 	const Time t = t1;
 	// The sqrt(delta) prevents issues where the simulation cannot advance at all (e.g. collision at t = 0.0000)
-	intersectionTimes[i * numberParticles + j] = max(sqrt(delta), t);
+	*collisionTime = max(sqrt(delta), t);
+
+	TRACE(TRACE_LEVEL_TESTS, TRACE_COLLISION, i, j, t);
+	return OUTCOME_COLLISION;
+}
+
+// PAIR_VECTOR_WIDTH is set by the host when building the program, from CL_DEVICE_PREFERRED_VECTOR_WIDTH_FLOAT (see
+// pairVectorWidth in configuration.h). With a width larger than 1 the pair kernels test that many partners at once with
+// floatN types, the host keeps it at 1 when every test is traced
+#ifndef PAIR_VECTOR_WIDTH
+#define PAIR_VECTOR_WIDTH 1
+#endif
+
+#if PAIR_VECTOR_WIDTH > 1
+#define CONCATENATE_(a, b) a ## b
+#define CONCATENATE(a, b) CONCATENATE_(a, b)
+#define floatN CONCATENATE(float, PAIR_VECTOR_WIDTH)
+#define intN CONCATENATE(int, PAIR_VECTOR_WIDTH)
+#define vloadN CONCATENATE(vload, PAIR_VECTOR_WIDTH)
+#define vstoreN CONCATENATE(vstore, PAIR_VECTOR_WIDTH)
+
+// Branch free particleParticleIntersectionTime for PAIR_VECTOR_WIDTH partners of the same particle, the outcomes are
+// selected in the reverse order of the checks of the scalar code so the first check that holds wins
+floatN particleParticleIntersectionTimes(const float2 pointA, const float2 velocityA, const floatN pointsX,
+                                         const floatN pointsY, const floatN velocitiesX, const floatN velocitiesY,
+                                         intN * const outcomes) {
+    const floatN dx = pointA.x - pointsX;
+    const floatN dy = pointA.y - pointsY;
+    const floatN dvx = velocityA.x - velocitiesX;
+    const floatN dvy = velocityA.y - velocitiesY;
+
+    const floatN a = dvx * dvx + dvy * dvy;
+    const floatN b = 2 * (dx * dvx + dy * dvy);
+    const floatN c = dx * dx + dy * dy - (2 * radius) * (2 * radius);
+    const floatN d = b * b - 4 * a * c;
+
+    const floatN root = sqrt(max(d, 0.0f));
+    const floatN t0 = (-b + root) / (2 * a);
+    const floatN t1 = (-b - root) / (2 * a);
+
+    intN outcome = (intN) OUTCOME_COLLISION;
+    outcome = select(outcome, (intN) OUTCOME_NO_INTERSECT, t0 < 0.0f && t1 > 0.0f && b <= epsilon);
+    outcome = select(outcome, (intN) OUTCOME_GETTING_FARTHER, b >= 0.0f);
+    outcome = select(outcome, (intN) OUTCOME_GLANCING, b > epsilon);
+    outcome = select(outcome, (intN) OUTCOME_NO_INTERSECT, d < 0.0f);
+    outcome = select(outcome, (intN) OUTCOME_OVERLAP, c <= 0.0f);
+    *outcomes = outcome;
+
+    // The sqrt(delta) prevents issues where the simulation cannot advance at all (e.g. collision at t = 0.0000)
+    return select((floatN) INFINITY, max((floatN) sqrt(delta), t1), outcome == OUTCOME_COLLISION);
+}
+
+// Gathers the partners of a particle into vectors, the particles are stored as an array of structures
+void loadPartners(global const struct Particle * particles, const uint * const partners, floatN * const pointsX,
+                  floatN * const pointsY, floatN * const velocitiesX, floatN * const velocitiesY) {
+    float x[PAIR_VECTOR_WIDTH];
+    float y[PAIR_VECTOR_WIDTH];
+    float vx[PAIR_VECTOR_WIDTH];
+    float vy[PAIR_VECTOR_WIDTH];
+
+    for (uint lane = 0; lane < PAIR_VECTOR_WIDTH; lane++) {
+        x[lane] = particles[partners[lane]].position.x;
+        y[lane] = particles[partners[lane]].position.y;
+        vx[lane] = particles[partners[lane]].velocity.x;
+        vy[lane] = particles[partners[lane]].velocity.y;
+    }
+
+    *pointsX = vloadN(0, x);
+    *pointsY = vloadN(0, y);
+    *velocitiesX = vloadN(0, vx);
+    *velocitiesY = vloadN(0, vy);
+}
+
+// Tests the partners of particle i, the outcome of every lane is stored for the counters
+floatN particleParticleIntersectionTimesOf(global const struct Particle * particles, const uint i,
+                                           const uint * const partners, int * const outcomes) {
+    floatN pointsX, pointsY, velocitiesX, velocitiesY;
+    loadPartners(particles, partners, &pointsX, &pointsY, &velocitiesX, &velocitiesY);
+
+    intN outcomeVector;
+    const floatN timeVector = particleParticleIntersectionTimes(particles[i].position, particles[i].velocity,
+                                                                pointsX, pointsY, velocitiesX, velocitiesY,
+                                                                &outcomeVector);
+    vstoreN(outcomeVector, 0, outcomes);
+    return timeVector;
+}
+#endif
+
+// Traced particle indices are global, first is system * numberParticles
+// With PAIR_VECTOR_WIDTH larger than 1 every work item takes that many consecutive j, the second dimension is divided
+// by it
+kernel void calculateIntersectionTime(global const struct Particle* ensembleParticlesInput,
+                                      global Time * const ensembleIntersectionTimes,
+                                      global uint * const outcomeCounters TRACE_PARAMETERS) {
+	local uint localCounters[2 * OUTCOME_COUNT];
+	clearLocalOutcomeCounters(localCounters);
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	const uint i = get_global_id(0);
+	const uint j = get_global_id(1);
+	const uint system = get_global_id(2);
+	const uint first = system * numberParticles;
+
+	global const struct Particle * const particlesInput = ensembleParticlesInput + first;
+	global Time * const intersectionTimes = ensembleIntersectionTimes + system * numberParticles * numberParticles;
+
+	// No early return, every work item has to reach the barriers. The global size is rounded up to whole work groups,
+	// the work items past the last particle test nothing
+#if PAIR_VECTOR_WIDTH > 1
+	const uint firstJ = j * PAIR_VECTOR_WIDTH;
+	if (i >= numberParticles) {
+		// Nothing to test
+	} else if (firstJ + PAIR_VECTOR_WIDTH <= i) {
+		uint partners[PAIR_VECTOR_WIDTH];
+		for (uint lane = 0; lane < PAIR_VECTOR_WIDTH; lane++) {
+			partners[lane] = firstJ + lane;
+		}
+
+		int outcomes[PAIR_VECTOR_WIDTH];
+		const floatN times = particleParticleIntersectionTimesOf(particlesInput, i, partners, outcomes);
+
+		vstoreN(times, 0, intersectionTimes + i * numberParticles + firstJ);
+		for (uint lane = 0; lane < PAIR_VECTOR_WIDTH; lane++) {
+			atomic_inc(&localCounters[outcomes[lane]]);
+		}
+	} else {
+		// The block that reaches the diagonal is done one pair at a time
+		for (uint k = firstJ; k < min(firstJ + PAIR_VECTOR_WIDTH, i); k++) {
+			Time t;
+			const enum Outcome outcome = particleParticleIntersectionTime(first + i, particlesInput[i].position,
+			                                                              particlesInput[i].velocity,
+			                                                              first + k, particlesInput[k].position,
+			                                                              particlesInput[k].velocity, &t TRACE_ARGUMENTS);
+			intersectionTimes[i * numberParticles + k] = t;
+			atomic_inc(&localCounters[outcome]);
+		}
+	}
+#else
+	if (i < numberParticles && i > j) {
+		Time t;
+		const enum Outcome outcome = particleParticleIntersectionTime(first + i, particlesInput[i].position,
+		                                                              particlesInput[i].velocity,
+		                                                              first + j, particlesInput[j].position,
+		                                                              particlesInput[j].velocity, &t TRACE_ARGUMENTS);
+		intersectionTimes[i * numberParticles + j] = t;
+		atomic_inc(&localCounters[outcome]);
+	}
+#endif
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+	mergeLocalOutcomeCounters(localCounters, outcomeCounters);
+}
+
+// Only builds the lists of the systems that asked for it, pairs that are not listed anymore must not be taken by findMin,
+// ensembleIntersectionTimes is 0 when the fused kernels are used and there is no matrix to clear
+kernel void buildNeighborLists(global const struct Particle * ensembleParticles,
+                               global Time * const ensembleIntersectionTimes, global uint * const ensembleNeighbors,
+                               global uint * const ensembleNeighborCounts, global float * const ensembleDisplacements,
+                               global const uint * rebuildFlags, global uint * const neighborCounters,
+                               const float skin) {
+    const uint i = get_global_id(0);
+    const uint system = get_global_id(1);
+    const uint first = system * numberParticles;
+
+    if (rebuildFlags[system] == 0) {
+        return;
+    }
+
+    global const struct Particle * const particles = ensembleParticles + first;
+    global Time * const intersectionTimes = ensembleIntersectionTimes + system * numberParticles * numberParticles;
+    global uint * const neighbors = ensembleNeighbors + (first + i) * maxNeighbors;
+
+    const float cutoff = 2 * radius + skin;
 
-	PRINT_DEBUG("Collision: %d((%f, %f), (%f, %f)) and %d((%f, %f), (%f, %f)) at time %f\n", i, pointA.x, pointA.y,
-	       velocityA.x, velocityA.y, j, pointB.x, pointB.y, velocityB.x, velocityB.y, t);
+    uint count = 0;
+    bool full = false;
+    for (uint j = 0; j < i; j++) {
+        if (ensembleIntersectionTimes != 0) {
+            intersectionTimes[i * numberParticles + j] = INFINITY;
+        }
+
+        if (distance(particles[i].position, particles[j].position) > cutoff) {
+            continue;
+        }
+
+        if (count == maxNeighbors) {
+            full = true;
+            continue;
+        }
+
+        neighbors[count++] = j;
+    }
+
+    ensembleNeighborCounts[first + i] = full ? NEIGHBOR_LIST_FULL : count;
+    ensembleDisplacements[first + i] = 0;
+
+    if (i == 0) {
+        atomic_inc(&neighborCounters[NEIGHBOR_REBUILDS]);
+    }
+    if (full) {
+        atomic_inc(&neighborCounters[NEIGHBOR_OVERFLOWS]);
+    }
+    atomic_add(&neighborCounters[NEIGHBOR_ENTRIES], full ? i : count);
+}
+
+// Same as calculateIntersectionTime but the second dimension goes over the neighbor list of i, a full list has more
+// partners than slots so every work item takes every maxNeighbors-th of them
+kernel void calculateNeighborIntersectionTime(global const struct Particle* ensembleParticlesInput,
+                                              global const uint * ensembleNeighbors,
+                                              global const uint * ensembleNeighborCounts,
+                                              global Time * const ensembleIntersectionTimes,
+                                              global uint * const outcomeCounters TRACE_PARAMETERS) {
+    local uint localCounters[2 * OUTCOME_COUNT];
+    clearLocalOutcomeCounters(localCounters);
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    const uint i = get_global_id(0);
+    const uint k = get_global_id(1);
+    const uint system = get_global_id(2);
+    const uint first = system * numberParticles;
+
+    global const struct Particle * const particlesInput = ensembleParticlesInput + first;
+    global const uint * const neighbors = ensembleNeighbors + first * maxNeighbors;
+    global const uint * const neighborCounts = ensembleNeighborCounts + first;
+    global Time * const intersectionTimes = ensembleIntersectionTimes + system * numberParticles * numberParticles;
+
+    // No early return, every work item has to reach the barriers. The global size is rounded up to whole work groups,
+    // the work items past the last particle test nothing
+    const uint partners = i < numberParticles ? neighborPartners(neighborCounts, i) : 0;
+    for (uint slot = k; slot < partners; slot += maxNeighbors) {
+        const uint j = neighborPartner(neighbors, neighborCounts, i, slot);
+
+        Time t;
+        const enum Outcome outcome = particleParticleIntersectionTime(first + i, particlesInput[i].position,
+                                                                      particlesInput[i].velocity,
+                                                                      first + j, particlesInput[j].position,
+                                                                      particlesInput[j].velocity, &t TRACE_ARGUMENTS);
+        intersectionTimes[i * numberParticles + j] = t;
+        atomic_inc(&localCounters[outcome]);
+    }
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+    mergeLocalOutcomeCounters(localCounters, outcomeCounters);
 }
 
-kernel void collisionTimeParticleWall(const uint i, const float velocity, const float point,
-                                      const float wall, local Time * collisionTime) { // TODO const char*?
+enum Outcome collisionTimeParticleWall(const uint i, const float velocity, const float point,
+                                       const float wall, Time * const collisionTime TRACE_PARAMETERS) {
     const float a = pow(velocity, 2);
     const float b = 2 * (point - wall) * velocity;
     const float c = (point - wall + radius) * (point - wall - radius);
 
     const float d = pow(b, 2) - 4 * a * c;
 
+    *collisionTime = INFINITY;
+
     if (d < 0) {
-        PRINT_DEBUG("No intersect: %d((%f), (%f)) and ", i, point, velocity);
-        *collisionTime = INFINITY;
-        return;
+        TRACE(TRACE_LEVEL_TESTS, TRACE_WALL_NO_INTERSECT, i, i, wall);
+        return OUTCOME_NO_INTERSECT;
     }
     if (b > epsilon) {
-        PRINT_DEBUG("Glancing: %d((%f), (%f)) and ", i, point, velocity);
-        *collisionTime = INFINITY;
-        return;
+        TRACE(TRACE_LEVEL_TESTS, TRACE_WALL_GLANCING, i, i, wall);
+        return OUTCOME_GLANCING;
     }
 
     const Time t0 = (-b + sqrt(d)) / (2 * a);
     const Time t1 = (-b - sqrt(d)) / (2 * a);
 
     if (b >= 0) {
-        PRINT_DEBUG("Getting farther: %d((%f), (%f)) and ", i, point, velocity);
-        *collisionTime = INFINITY;
-        return;
+        TRACE(TRACE_LEVEL_TESTS, TRACE_WALL_GETTING_FARTHER, i, i, wall);
+        return OUTCOME_GETTING_FARTHER;
     }
     if (t0 < 0 && t1 > 0 && b <= epsilon) {
-        PRINT_DEBUG("No intersect: %d((%f), (%f)) and ", i, point, velocity);
-        *collisionTime = INFINITY;
-        return;
+        TRACE(TRACE_LEVEL_TESTS, TRACE_WALL_NO_INTERSECT, i, i, wall);
+        return OUTCOME_NO_INTERSECT;
     }
 
     const Time t = t1;
     // The sqrt(delta) prevents issues where the simulation cannot advance at all (e.g. collision at t = 0.0000)
     *collisionTime = max(sqrt(delta), t);
 
-    PRINT_DEBUG("Collision: %d((%f), (%f)) and ", i, point, velocity);
+    TRACE(TRACE_LEVEL_TESTS, TRACE_WALL_COLLISION, i, i, t);
+    return OUTCOME_COLLISION;
 }
 
-kernel void calculateIntersectionBorderTime(global const struct Particle *positionsInput,
-                                            global Time * const intersectionTimes,
-                                            global struct Collision * const collidedParticles) {
+kernel void calculateIntersectionBorderTime(global const struct Particle *ensemblePositionsInput,
+                                            global Time * const ensembleIntersectionTimes,
+                                            global struct Collision * const ensembleCollidedParticles,
+                                            global uint * const outcomeCounters TRACE_PARAMETERS) {
+    local uint localCounters[2 * OUTCOME_COUNT];
+    clearLocalOutcomeCounters(localCounters);
+    barrier(CLK_LOCAL_MEM_FENCE);
+
     const uint i = get_global_id(0);
+    const uint system = get_global_id(1);
+    const uint first = system * numberParticles;
 
-    local Time t0, t1, t2, t3;// HACK kernel may not have a non-void return
-    collisionTimeParticleWall(i, positionsInput[i].velocity.x, positionsInput[i].position.x, 0, &t0); PRINT_DEBUG("%d: Wx = 0 at time %f\n", i, t0); // HACK printf %s must have literal string
-    collisionTimeParticleWall(i, positionsInput[i].velocity.x, positionsInput[i].position.x, width, &t1); PRINT_DEBUG("%d: Wx = width at time %f\n", i, t0);
-    collisionTimeParticleWall(i, positionsInput[i].velocity.y, positionsInput[i].position.y, 0, &t2); PRINT_DEBUG("%d: Wy = 0 at time %f\n", i, t0);
-    collisionTimeParticleWall(i, positionsInput[i].velocity.y, positionsInput[i].position.y, height, &t3); PRINT_DEBUG("%d: Wy = height at time %f\n", i, t0);
+    global const struct Particle * const positionsInput = ensemblePositionsInput + first;
+    global Time * const intersectionTimes = ensembleIntersectionTimes + system * numberParticles * numberParticles;
+    global struct Collision * const collidedParticles = ensembleCollidedParticles + first;
 
-    intersectionTimes[i * numberParticles + i] = min(min(t0, t1), min(t2, t3));
+    // No early return, every work item has to reach the barriers. The global size is rounded up to whole work groups
+    if (i < numberParticles) {
+        const float2 position = positionsInput[i].position;
+        const float2 velocity = positionsInput[i].velocity;
 
-    if (min(t0, t1) < min(t2, t3)) {
-        collidedParticles[i].type = PARTICLE_WALL_X;
-    } else {
-        collidedParticles[i].type = PARTICLE_WALL_Y;
+        Time t0, t1, t2, t3;
+        atomic_inc(&localCounters[wallOutcomesOffset + collisionTimeParticleWall(first + i, velocity.x, position.x, 0, &t0 TRACE_ARGUMENTS)]);
+        atomic_inc(&localCounters[wallOutcomesOffset + collisionTimeParticleWall(first + i, velocity.x, position.x, width, &t1 TRACE_ARGUMENTS)]);
+        atomic_inc(&localCounters[wallOutcomesOffset + collisionTimeParticleWall(first + i, velocity.y, position.y, 0, &t2 TRACE_ARGUMENTS)]);
+        atomic_inc(&localCounters[wallOutcomesOffset + collisionTimeParticleWall(first + i, velocity.y, position.y, height, &t3 TRACE_ARGUMENTS)]);
+
+        intersectionTimes[i * numberParticles + i] = min(min(t0, t1), min(t2, t3));
+
+        if (min(t0, t1) < min(t2, t3)) {
+            collidedParticles[i].type = PARTICLE_WALL_X;
+        } else {
+            collidedParticles[i].type = PARTICLE_WALL_Y;
+        }
     }
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+    mergeLocalOutcomeCounters(localCounters, outcomeCounters);
+}
+
+// Cuts the event short before any particle moves more than half the skin since its list was built, true if it did
+bool limitToNeighborSkin(global const struct Particle * particles, global const float * displacements,
+                         const float skin, global Time * const result) {
+    bool limited = false;
+
+    for (uint i = 0; i < numberParticles; i++) {
+        const float speed = length(particles[i].velocity);
+        const Time budget = max(0.0f, (skin / 2 - displacements[i]) / speed);
+
+        if (budget < *result) {
+            *result = budget;
+            limited = true;
+        }
+    }
+
+    return limited;
 }
 
 // TODO do a reduction as recommended by OpenCL
-kernel void findMin(global const Time *intersectionTimes, global struct Collision* const collidedParticles,
-                    global Time* result) {
-    *result = dt;
+// Each system looks for its own next event, no further than its horizon, which is then reduced by the timestep, so a
+// batch of steps stops every system at its own target without the host in between. eventCounts counts the steps that
+// advanced the system
+// With neighbor lists no particle may move more than half the skin since the last build, or pairs that are not listed
+// could collide, the event is cut short at that point and the lists of the system are rebuilt on the next step
+kernel void findMin(global const Time *ensembleIntersectionTimes, global struct Collision* const ensembleCollidedParticles,
+                    global Time* ensembleResults, global Time * const horizons,
+                    global const struct Particle * ensembleParticles, global const float * ensembleDisplacements,
+                    global uint * const rebuildFlags, const float skin,
+                    global struct EventRecord * const eventRecords,
+                    global uint * const eventCounts TRACE_PARAMETERS) {
+    const uint system = get_global_id(0);
+
+    eventRecords[system].type = NONE;
+
+    global const Time * const intersectionTimes = ensembleIntersectionTimes + system * numberParticles * numberParticles;
+    global struct Collision * const collidedParticles = ensembleCollidedParticles + system * numberParticles;
+    global Time * const result = ensembleResults + system;
+
+    *result = min(dt, horizons[system]);
+
+    bool rebuild = skin > 0 && limitToNeighborSkin(ensembleParticles + system * numberParticles,
+                                                   ensembleDisplacements + system * numberParticles, skin, result);
 
     bool collision = false; // This is because there could be no collision in the timeframe
     uint indexA = 0;
@@ -174,8 +594,6 @@ kernel void findMin(global const Time *intersectionTimes, global struct Collisio
             if (i < j) {
                 continue;
             }
-            PRINT_DEBUG("(%d, %d): %f\n", i, j, intersectionTimes[i * numberParticles + j]);
-
             const Time intersectionTimeA = intersectionTimes[i * numberParticles + j];
 
             if (intersectionTimeA < *result) {
@@ -183,10 +601,20 @@ kernel void findMin(global const Time *intersectionTimes, global struct Collisio
                 indexA = i;
                 indexB = j;
                 collision = true;
+                rebuild = false;
             }
         }
     }
 
+    if (skin > 0) {
+        rebuildFlags[system] = rebuild;
+    }
+
+    horizons[system] -= *result;
+    if (*result > 0) {
+        eventCounts[system]++;
+    }
+
     for (unsigned int i = 0; i < numberParticles; i++) {
         if (collision && indexA == i) {
             continue;
@@ -208,30 +636,450 @@ kernel void findMin(global const Time *intersectionTimes, global struct Collisio
     }
 }
 
-kernel void advanceSimulation(global struct Particle * const particlesInput,
-                              global struct Particle * const particlesOutput,
-                              global const struct Collision * collidingParticles,
-                              global const Time* timestepPtr) {
+// Fused variant of calculateIntersectionTime, calculateIntersectionBorderTime and findMin: every work item finds the
+// first event of its particle, the work group reduces them in local memory and only the winner of every group is
+// written, so there is no numberParticles² matrix. Ties go to the lowest index, as in findMin
 
-    const Time timestep = *timestepPtr;
-    if(timestep == 0) {
-        PRINT_DEBUG("Timestep is 0, infinite loop!\n");
+// Must match fusedGroupSize in configuration.h
+#define FUSED_GROUP_SIZE 64
+
+struct __attribute__((packed)) FusedWinner {
+    Time time;
+    uint indexA;
+    uint indexB;
+    enum CollisionType type;
+};
+
+// First event of particle i, only replaces best when it is strictly earlier. Without neighbor lists (neighbors is 0)
+// every particle before i is a partner. candidates counts the pair and wall times earlier than limit
+void firstEventOfParticle(global const struct Particle * particlesInput, const uint first, const uint i,
+                          global const uint * neighbors, global const uint * neighborCounts,
+                          local uint * const localCounters, const Time limit, uint * const candidates,
+                          Time * const best, uint * const partner, enum CollisionType * const type TRACE_PARAMETERS) {
+    const float2 position = particlesInput[i].position;
+    const float2 velocity = particlesInput[i].velocity;
+
+    // Same order as a row of the matrix, partners first and the walls last
+    const uint partners = neighbors != 0 ? neighborPartners(neighborCounts, i) : i;
+    uint k = 0;
+#if PAIR_VECTOR_WIDTH > 1
+    for (; k + PAIR_VECTOR_WIDTH <= partners; k += PAIR_VECTOR_WIDTH) {
+        uint indices[PAIR_VECTOR_WIDTH];
+        for (uint lane = 0; lane < PAIR_VECTOR_WIDTH; lane++) {
+            indices[lane] = neighbors != 0 ? neighborPartner(neighbors, neighborCounts, i, k + lane) : k + lane;
+        }
+
+        float times[PAIR_VECTOR_WIDTH];
+        int outcomes[PAIR_VECTOR_WIDTH];
+        vstoreN(particleParticleIntersectionTimesOf(particlesInput, i, indices, outcomes), 0, times);
+
+        for (uint lane = 0; lane < PAIR_VECTOR_WIDTH; lane++) {
+            atomic_inc(&localCounters[outcomes[lane]]);
+            *candidates += times[lane] < limit;
+
+            if (times[lane] < *best) {
+                *best = times[lane];
+                *partner = indices[lane];
+                *type = PARTICLE_PARTICLE;
+            }
+        }
+    }
+#endif
+    // The partners that do not fill a vector
+    for (; k < partners; k++) {
+        const uint j = neighbors != 0 ? neighborPartner(neighbors, neighborCounts, i, k) : k;
+
+        Time t;
+        const enum Outcome outcome = particleParticleIntersectionTime(first + i, position, velocity,
+                                                                      first + j, particlesInput[j].position,
+                                                                      particlesInput[j].velocity, &t TRACE_ARGUMENTS);
+        atomic_inc(&localCounters[outcome]);
+        *candidates += t < limit;
+
+        if (t < *best) {
+            *best = t;
+            *partner = j;
+            *type = PARTICLE_PARTICLE;
+        }
+    }
+
+    Time t0, t1, t2, t3;
+    atomic_inc(&localCounters[wallOutcomesOffset + collisionTimeParticleWall(first + i, velocity.x, position.x, 0, &t0 TRACE_ARGUMENTS)]);
+    atomic_inc(&localCounters[wallOutcomesOffset + collisionTimeParticleWall(first + i, velocity.x, position.x, width, &t1 TRACE_ARGUMENTS)]);
+    atomic_inc(&localCounters[wallOutcomesOffset + collisionTimeParticleWall(first + i, velocity.y, position.y, 0, &t2 TRACE_ARGUMENTS)]);
+    atomic_inc(&localCounters[wallOutcomesOffset + collisionTimeParticleWall(first + i, velocity.y, position.y, height, &t3 TRACE_ARGUMENTS)]);
+
+    const Time wallTime = min(min(t0, t1), min(t2, t3));
+    *candidates += wallTime < limit;
+    if (wallTime < *best) {
+        *best = wallTime;
+        *partner = i;
+        *type = min(t0, t1) < min(t2, t3) ? PARTICLE_WALL_X : PARTICLE_WALL_Y;
+    }
+}
+
+kernel __attribute__((reqd_work_group_size(FUSED_GROUP_SIZE, 1, 1)))
+void calculateFusedIntersectionTime(global const struct Particle * ensembleParticlesInput,
+                                    global const uint * ensembleNeighbors, global const uint * ensembleNeighborCounts,
+                                    const float skin, global const Time * horizons,
+                                    global struct FusedWinner * const ensembleWinners,
+                                    global uint * const outcomeCounters,
+                                    global uint * const candidateCounters TRACE_PARAMETERS) {
+    local uint localCounters[2 * OUTCOME_COUNT];
+    local Time localTimes[FUSED_GROUP_SIZE];
+    local uint localIndices[FUSED_GROUP_SIZE];
+    local uint localCandidates;
+    clearLocalOutcomeCounters(localCounters);
+    if (get_local_id(0) == 0) {
+        localCandidates = 0;
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    // The global size is rounded up to the group size, the extra work items only take part in the reduction
+    const uint i = get_global_id(0);
+    const uint system = get_global_id(1);
+    const uint first = system * numberParticles;
+    const uint localIndex = get_local_id(0);
+
+    global const struct Particle * const particlesInput = ensembleParticlesInput + first;
+
+    Time best = INFINITY;
+    uint partner = i;
+    enum CollisionType type = NONE;
+    uint candidates = 0;
+
+    if (i < numberParticles) {
+        firstEventOfParticle(particlesInput, first, i, skin > 0 ? ensembleNeighbors + first * maxNeighbors : 0,
+                             ensembleNeighborCounts + first, localCounters, min(dt, horizons[system]), &candidates,
+                             &best, &partner, &type TRACE_ARGUMENTS);
+        atomic_add(&localCandidates, candidates);
+    }
+
+    localTimes[localIndex] = best;
+    localIndices[localIndex] = localIndex;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (uint stride = FUSED_GROUP_SIZE / 2; stride > 0; stride /= 2) {
+        if (localIndex < stride) {
+            const Time other = localTimes[localIndex + stride];
+            const uint otherIndex = localIndices[localIndex + stride];
+            // After the first stride either half may hold the lower index, so ties compare the indices
+            if (other < localTimes[localIndex]
+                || (other == localTimes[localIndex] && otherIndex < localIndices[localIndex])) {
+                localTimes[localIndex] = other;
+                localIndices[localIndex] = otherIndex;
+            }
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    if (localIndices[0] == localIndex) {
+        global struct FusedWinner * const winner = ensembleWinners + system * get_num_groups(0) + get_group_id(0);
+        winner->time = best;
+        winner->indexA = i;
+        winner->indexB = partner;
+        winner->type = type;
+    }
+
+    if (localIndex == 0) {
+        if (get_group_id(0) == 0) {
+            atomic_inc(&candidateCounters[CANDIDATE_STEPS]);
+        }
+        atomic_add(&candidateCounters[CANDIDATE_ENTRIES], localCandidates);
+    }
+
+    mergeLocalOutcomeCounters(localCounters, outcomeCounters);
+}
+
+// findMin over the winners of calculateFusedIntersectionTime, or over the candidates of compactCandidates. Every system
+// has groups entries, of which only the first counts[system] are used when counts is not 0. A system with more
+// candidates than that did not fit in its list, it walks its matrix instead, in the same order
+kernel void findMinFused(global const struct FusedWinner * ensembleWinners, const uint groups,
+                         global const uint * counts, global const Time * ensembleIntersectionTimes,
+                         global struct Collision * const ensembleCollidedParticles, global Time * ensembleResults,
+                         global Time * const horizons, global const struct Particle * ensembleParticles,
+                         global const float * ensembleDisplacements, global uint * const rebuildFlags,
+                         const float skin, global struct EventRecord * const eventRecords,
+                         global uint * const eventCounts TRACE_PARAMETERS) {
+    const uint system = get_global_id(0);
+
+    eventRecords[system].type = NONE;
+
+    global const struct FusedWinner * const winners = ensembleWinners + system * groups;
+    global struct Collision * const collidedParticles = ensembleCollidedParticles + system * numberParticles;
+    global Time * const result = ensembleResults + system;
+
+    *result = min(dt, horizons[system]);
+
+    bool rebuild = skin > 0 && limitToNeighborSkin(ensembleParticles + system * numberParticles,
+                                                   ensembleDisplacements + system * numberParticles, skin, result);
+
+    bool collision = false; // This is because there could be no collision in the timeframe
+    struct FusedWinner winner;
+
+    const uint used = counts != 0 ? counts[system] : groups;
+    if (used <= groups) {
+        for (uint group = 0; group < used; group++) {
+            if (winners[group].time < *result) {
+                *result = winners[group].time;
+                winner = winners[group];
+                collision = true;
+                rebuild = false;
+            }
+        }
+    } else {
+        global const Time * const intersectionTimes = ensembleIntersectionTimes
+                                                      + system * numberParticles * numberParticles;
+
+        for (uint i = 0; i < numberParticles; i++) {
+            for (uint j = 0; j <= i; j++) {
+                const Time t = intersectionTimes[i * numberParticles + j];
+                if (t < *result) {
+                    *result = t;
+                    winner.time = t;
+                    winner.indexA = i;
+                    winner.indexB = j;
+                    // The wall kernel already chose the wall of the diagonal
+                    winner.type = i == j ? ensembleCollidedParticles[system * numberParticles + i].type
+                                         : PARTICLE_PARTICLE;
+                    collision = true;
+                    rebuild = false;
+                }
+            }
+        }
+    }
+
+    if (skin > 0) {
+        rebuildFlags[system] = rebuild;
+    }
+
+    horizons[system] -= *result;
+    if (*result > 0) {
+        eventCounts[system]++;
+    }
+
+    for (uint i = 0; i < numberParticles; i++) {
+        collidedParticles[i].type = NONE;
+    }
+
+    if (!collision) {
         return;
     }
 
+    collidedParticles[winner.indexA].type = winner.type;
+    collidedParticles[winner.indexA].indexB = winner.indexB;
+
+    if (winner.type == PARTICLE_PARTICLE) {
+        collidedParticles[winner.indexB].type = IGNORE;
+    }
+}
+
+// Stream compaction of the matrix: nearly every time in it is INFINITY or past the end of the step, so only the
+// pair and wall times below min(dt, horizon) are passed to findMinFused, as a dense list of candidates per system.
+// The list keeps the order in which findMin walks the matrix, so ties still go to the lowest indices. Work groups of
+// rows count their candidates, a scan turns the counts of the groups into offsets and every row writes its own
+
+// Must match candidateGroupSize in configuration.h
+#define CANDIDATE_GROUP_SIZE 64
+
+// Exclusive prefix sum of the values of a work group of CANDIDATE_GROUP_SIZE work items, a Hillis-Steele scan in
+// local memory. Every work item of the group must call it. total is set to the sum of all of them
+uint scanGroup(local uint * const sums, const uint value, uint * const total) {
+    const uint localIndex = get_local_id(0);
+
+    sums[localIndex] = value;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (uint stride = 1; stride < CANDIDATE_GROUP_SIZE; stride *= 2) {
+        const uint previous = localIndex >= stride ? sums[localIndex - stride] : 0;
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        sums[localIndex] += previous;
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    const uint inclusive = sums[localIndex];
+    *total = sums[CANDIDATE_GROUP_SIZE - 1];
+    // The sums can be written again once everyone read them
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    return inclusive - value;
+}
+
+// Candidates of row i, the pairs with j < i and the walls of i on the diagonal
+uint rowCandidates(global const Time * row, const uint i, const Time limit) {
+    uint count = 0;
+    for (uint j = 0; j <= i; j++) {
+        count += row[j] < limit;
+    }
+    return count;
+}
+
+kernel __attribute__((reqd_work_group_size(CANDIDATE_GROUP_SIZE, 1, 1)))
+void countCandidates(global const Time * ensembleIntersectionTimes, global const Time * horizons,
+                     global uint * const ensembleRowCounts, global uint * const ensembleGroupCounts) {
+    local uint groupCount;
+    if (get_local_id(0) == 0) {
+        groupCount = 0;
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    // The global size is rounded up to the group size, the extra work items count nothing
+    const uint i = get_global_id(0);
+    const uint system = get_global_id(1);
+    const uint first = system * numberParticles;
+
+    if (i < numberParticles) {
+        global const Time * const row = ensembleIntersectionTimes + (first + i) * numberParticles;
+        const uint count = rowCandidates(row, i, min(dt, horizons[system]));
+
+        ensembleRowCounts[first + i] = count;
+        atomic_add(&groupCount, count);
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    if (get_local_id(0) == 0) {
+        ensembleGroupCounts[system * get_num_groups(0) + get_group_id(0)] = groupCount;
+    }
+}
+
+// Exclusive prefix sum of the group counts of every system, the total is the length of its list. One work group per
+// system scans the counts CANDIDATE_GROUP_SIZE at a time. A total above capacity is kept, so findMinFused knows the
+// list was cut short
+kernel __attribute__((reqd_work_group_size(CANDIDATE_GROUP_SIZE, 1, 1)))
+void scanCandidates(global uint * const ensembleGroupCounts, const uint groups, const uint capacity,
+                    global uint * const candidateCounts, global uint * const candidateCounters) {
+    local uint sums[CANDIDATE_GROUP_SIZE];
+
+    const uint localIndex = get_local_id(0);
+    const uint system = get_global_id(1);
+
+    global uint * const groupCounts = ensembleGroupCounts + system * groups;
+
+    uint sum = 0;
+    for (uint chunk = 0; chunk < groups; chunk += CANDIDATE_GROUP_SIZE) {
+        const uint group = chunk + localIndex;
+
+        uint chunkSum;
+        const uint offset = scanGroup(sums, group < groups ? groupCounts[group] : 0, &chunkSum);
+        if (group < groups) {
+            groupCounts[group] = sum + offset;
+        }
+        sum += chunkSum;
+    }
+
+    if (localIndex == 0) {
+        candidateCounts[system] = sum;
+        atomic_inc(&candidateCounters[CANDIDATE_STEPS]);
+        atomic_add(&candidateCounters[CANDIDATE_ENTRIES], sum);
+        if (sum > capacity) {
+            atomic_inc(&candidateCounters[CANDIDATE_OVERFLOWS]);
+        }
+    }
+}
+
+// Every system has room for capacity candidates, the ones past it are dropped
+kernel __attribute__((reqd_work_group_size(CANDIDATE_GROUP_SIZE, 1, 1)))
+void compactCandidates(global const Time * ensembleIntersectionTimes,
+                       global const struct Collision * ensembleCollidedParticles, global const Time * horizons,
+                       global const uint * ensembleRowCounts, global const uint * ensembleGroupCounts,
+                       global struct FusedWinner * const ensembleCandidates, const uint capacity) {
+    local uint sums[CANDIDATE_GROUP_SIZE];
+
+    const uint i = get_global_id(0);
+    const uint system = get_global_id(1);
+    const uint first = system * numberParticles;
+
+    // The extra work items of the last group take part in the scan with no candidates
+    uint groupSum;
+    uint offset = scanGroup(sums, i < numberParticles ? ensembleRowCounts[first + i] : 0, &groupSum);
+
+    if (i >= numberParticles) {
+        return;
+    }
+
+    offset += ensembleGroupCounts[system * get_num_groups(0) + get_group_id(0)];
+
+    global const Time * const row = ensembleIntersectionTimes + (first + i) * numberParticles;
+    global struct FusedWinner * const candidates = ensembleCandidates + system * capacity;
+    const Time limit = min(dt, horizons[system]);
+
+    for (uint j = 0; j <= i && offset < capacity; j++) {
+        const Time t = row[j];
+        if (t >= limit) {
+            continue;
+        }
+
+        global struct FusedWinner * const candidate = candidates + offset++;
+        candidate->time = t;
+        candidate->indexA = i;
+        candidate->indexB = j;
+        // The wall kernel already chose the wall of the diagonal
+        candidate->type = i == j ? ensembleCollidedParticles[first + i].type : PARTICLE_PARTICLE;
+    }
+}
+
+void recordWallEvent(global struct EventRecord * const eventRecord, const enum CollisionType type, const uint id,
+                     const float2 velocity) {
+    eventRecord->type = type;
+    eventRecord->indexA = id;
+    eventRecord->indexB = id;
+    eventRecord->velocityA = velocity;
+    eventRecord->velocityB = velocity;
+}
+
+// Velocities after the elastic collision of two particles that are touching
+void collideParticles(const float2 positionA, const float2 positionB, const float2 velocityA, const float2 velocityB,
+                      float2 * const velocityCorrectedA, float2 * const velocityCorrectedB) {
+    const float2 substract = positionA - positionB;
+    const float distanceSquared = pow(substract.x, 2) + pow(substract.y, 2);
+    const float product = (velocityA.x - velocityB.x) * (positionA.x - positionB.x)
+                            + (velocityA.y - velocityB.y) * (positionA.y - positionB.y);
+    const float2 difference = (product / distanceSquared) * substract;
+
+    // The sqrt(delta) prevents issues where the simulation cannot advance at all (e.g. velocity is small and timestep is small)
+    const float2 idealVelocityA = velocityA - difference;
+    *velocityCorrectedA = idealVelocityA < sqrt(delta)? 0:idealVelocityA;
+    const float2 idealVelocityB = velocityB + difference;
+    *velocityCorrectedB = idealVelocityB < sqrt(delta)? 0:idealVelocityB;
+}
+
+kernel void advanceSimulation(global struct Particle * const ensembleParticlesInput,
+                              global struct Particle * const ensembleParticlesOutput,
+                              global const struct Collision * ensembleCollidingParticles,
+                              global const Time* timesteps, global float * const ensembleDisplacements,
+                              global const uint * ensembleParticleIds,
+                              global struct EventRecord * const eventRecords TRACE_PARAMETERS) {
     const uint i = get_global_id(0);
+    const uint system = get_global_id(1);
+    const uint first = system * numberParticles;
+
+    global struct Particle * const particlesInput = ensembleParticlesInput + first;
+    global struct Particle * const particlesOutput = ensembleParticlesOutput + first;
+    global const struct Collision * const collidingParticles = ensembleCollidingParticles + first;
+
+    const Time timestep = timesteps[system];
+
+    if(timestep == 0) {
+        if (i == 0) {
+            TRACE(TRACE_LEVEL_EVENTS, TRACE_ZERO_TIMESTEP, first + i, first + i, timestep);
+        }
+        // The host swaps input and output after every step, so the state has to be carried over
+        particlesOutput[i] = particlesInput[i];
+        return;
+    }
+
+    // Every particle moves with its incoming velocity for the whole timestep, whatever happens at the end of it
+    ensembleDisplacements[first + i] += length(particlesInput[i].velocity) * timestep;
 
     switch (collidingParticles[i].type) {
         case NONE: {
             particlesOutput[i].position = particlesInput[i].position + timestep * particlesInput[i].velocity;
             particlesOutput[i].velocity = particlesInput[i].velocity;
-
-            PRINT_DEBUG("%d: No collision!\n", i);
             return;
         }
         case IGNORE: {
             //Another particle is dealing with the collision
-            PRINT_DEBUG("%d: Other particle collision!\n", i);
             return;
         }
         case PARTICLE_PARTICLE: {
@@ -240,52 +1088,296 @@ kernel void advanceSimulation(global struct Particle * const particlesInput,
             particlesOutput[i].position = particlesInput[i].position + timestep * particlesInput[i].velocity;
             particlesOutput[indexB].position = particlesInput[indexB].position + timestep * particlesInput[indexB].velocity;
 
-            const float2 positionA = particlesOutput[i].position;
-            const float2 positionB = particlesOutput[indexB].position;
             const float2 velocityA = particlesInput[i].velocity;
             const float2 velocityB = particlesInput[indexB].velocity;
 
-            const float2 substract = positionA - positionB;
-            const float distanceSquared = pow(substract.x, 2) + pow(substract.y, 2);
-            const float product = (velocityA.x - velocityB.x) * (positionA.x - positionB.x)
-                                    + (velocityA.y - velocityB.y) * (positionA.y - positionB.y);
-            const float2 difference = (product / distanceSquared) * substract;
+            float2 velocityCorrectedA, velocityCorrectedB;
+            collideParticles(particlesOutput[i].position, particlesOutput[indexB].position, velocityA, velocityB,
+                             &velocityCorrectedA, &velocityCorrectedB);
 
-            // The sqrt(delta) prevents issues where the simulation cannot advance at all (e.g. velocity is small and timestep is small)
-            const float2 idealVelocityA = velocityA - difference;
-            const float2 velocityCorrectedA = idealVelocityA < sqrt(delta)? 0:idealVelocityA;
-            const float2 idealVelocityB = velocityB + difference;
-            const float2 velocityCorrectedB = idealVelocityB < sqrt(delta)? 0:idealVelocityB;
-
-#if DEBUG
+#if TRACE_LEVEL >= TRACE_LEVEL_EVENTS
             const float accumulatedError = (velocityA.x * velocityB.x + velocityA.y * velocityB.y)
                 - (velocityCorrectedA.x * velocityCorrectedB.x + velocityCorrectedA.y * velocityCorrectedB.y);
-            printf("Collision error: %f", accumulatedError);
+            TRACE(TRACE_LEVEL_EVENTS, TRACE_COLLISION_ERROR, first + i, first + indexB, accumulatedError);
 #endif
 
             particlesOutput[i].velocity = velocityCorrectedA;
             particlesOutput[indexB].velocity = velocityCorrectedB;
 
+            eventRecords[system].type = PARTICLE_PARTICLE;
+            eventRecords[system].indexA = ensembleParticleIds[first + i];
+            eventRecords[system].indexB = ensembleParticleIds[first + indexB];
+            eventRecords[system].velocityA = velocityCorrectedA;
+            eventRecords[system].velocityB = velocityCorrectedB;
 
-            PRINT_DEBUG("%d: Particle collision with %d!\n", i, indexB);
+            TRACE(TRACE_LEVEL_EVENTS, TRACE_PARTICLE_PARTICLE, first + i, first + indexB, timestep);
             return;
         }
         case PARTICLE_WALL_X: {
             particlesOutput[i].position = particlesInput[i].position + timestep * particlesInput[i].velocity;
             particlesOutput[i].velocity.x = -particlesInput[i].velocity.x;
             particlesOutput[i].velocity.y = particlesInput[i].velocity.y;
-            PRINT_DEBUG("%d: Wall X collision!\n", i);
+            recordWallEvent(eventRecords + system, PARTICLE_WALL_X, ensembleParticleIds[first + i],
+                            particlesOutput[i].velocity);
+            TRACE(TRACE_LEVEL_EVENTS, TRACE_PARTICLE_WALL_X, first + i, first + i, timestep);
             return;
         }
         case PARTICLE_WALL_Y: {
             particlesOutput[i].position = particlesInput[i].position + timestep * particlesInput[i].velocity;
             particlesOutput[i].velocity.x = particlesInput[i].velocity.x;
             particlesOutput[i].velocity.y = -particlesInput[i].velocity.y;
-            PRINT_DEBUG("%d: Wall Y collision!\n", i);
+            recordWallEvent(eventRecords + system, PARTICLE_WALL_Y, ensembleParticleIds[first + i],
+                            particlesOutput[i].velocity);
+            TRACE(TRACE_LEVEL_EVENTS, TRACE_PARTICLE_WALL_Y, first + i, first + i, timestep);
             return;
         }
         default:
-            PRINT_DEBUG("Wrong particle collision type!\n");
             return;
     }
 }
+
+// Runs up to events steps of a system in a single launch, one work group per system: the first event of every particle
+// is found as in calculateFusedIntersectionTime, reduced in local memory and the particles are advanced in place, with
+// barriers between the stages instead of kernel launches. As with findMin every step stops at dt or the horizon, which
+// is consumed, and once it is used up the remaining steps are left empty. The timestep and event record of every step
+// are written to timesteps and stepRecords, step after step, each with a slot for every system. Tests all the pairs,
+// neighbor lists are not used
+kernel __attribute__((reqd_work_group_size(FUSED_GROUP_SIZE, 1, 1)))
+void simulatePersistent(global struct Particle * const ensembleParticles, global const uint * ensembleParticleIds,
+                        global Time * const horizons, const uint events, global Time * const timesteps,
+                        global struct EventRecord * const stepRecords, global uint * const eventCounts,
+                        global uint * const outcomeCounters TRACE_PARAMETERS) {
+    local uint localCounters[2 * OUTCOME_COUNT];
+    local struct FusedWinner localWinners[FUSED_GROUP_SIZE];
+    local Time horizon;
+
+    const uint localIndex = get_local_id(0);
+    const uint system = get_global_id(1);
+    const uint systems = get_global_size(1);
+    const uint first = system * numberParticles;
+
+    global struct Particle * const particles = ensembleParticles + first;
+    global const uint * const particleIds = ensembleParticleIds + first;
+
+    clearLocalOutcomeCounters(localCounters);
+    if (localIndex == 0) {
+        horizon = horizons[system];
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    uint step = 0;
+    for (; step < events && horizon > 0; step++) {
+        // Every work item takes every FUSED_GROUP_SIZE-th particle from localIndex, ties go to the lowest index
+        struct FusedWinner best = { INFINITY, numberParticles, numberParticles, NONE };
+        for (uint i = localIndex; i < numberParticles; i += FUSED_GROUP_SIZE) {
+            Time time = best.time;
+            uint partner = best.indexB;
+            enum CollisionType type = best.type;
+            // Persistent launches do not count candidates, no time is below 0
+            uint candidates = 0;
+            firstEventOfParticle(particles, first, i, 0, 0, localCounters, 0, &candidates, &time, &partner, &type
+                                 TRACE_ARGUMENTS);
+
+            if (time < best.time) {
+                best = (struct FusedWinner) { time, i, partner, type };
+            }
+        }
+
+        localWinners[localIndex] = best;
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        for (uint stride = FUSED_GROUP_SIZE / 2; stride > 0; stride /= 2) {
+            if (localIndex < stride) {
+                const struct FusedWinner other = localWinners[localIndex + stride];
+                if (other.time < localWinners[localIndex].time
+                    || (other.time == localWinners[localIndex].time && other.indexA < localWinners[localIndex].indexA)) {
+                    localWinners[localIndex] = other;
+                }
+            }
+            barrier(CLK_LOCAL_MEM_FENCE);
+        }
+
+        const struct FusedWinner winner = localWinners[0];
+        const Time limit = min(dt, horizon);
+        const bool collision = winner.time < limit;
+        const Time timestep = collision ? winner.time : limit;
+
+        // Every pair time was computed before any particle moves
+        for (uint i = localIndex; i < numberParticles; i += FUSED_GROUP_SIZE) {
+            particles[i].position += timestep * particles[i].velocity;
+        }
+        barrier(CLK_GLOBAL_MEM_FENCE | CLK_LOCAL_MEM_FENCE);
+
+        if (localIndex == 0) {
+            global struct EventRecord * const eventRecord = stepRecords + step * systems + system;
+            eventRecord->type = NONE;
+            timesteps[step * systems + system] = timestep;
+            horizon -= timestep;
+
+            if (collision && winner.type == PARTICLE_PARTICLE) {
+                global struct Particle * const particleA = particles + winner.indexA;
+                global struct Particle * const particleB = particles + winner.indexB;
+
+                float2 velocityA, velocityB;
+                collideParticles(particleA->position, particleB->position, particleA->velocity, particleB->velocity,
+                                 &velocityA, &velocityB);
+
+#if TRACE_LEVEL >= TRACE_LEVEL_EVENTS
+                const float accumulatedError = (particleA->velocity.x * particleB->velocity.x
+                                                + particleA->velocity.y * particleB->velocity.y)
+                    - (velocityA.x * velocityB.x + velocityA.y * velocityB.y);
+                TRACE(TRACE_LEVEL_EVENTS, TRACE_COLLISION_ERROR, first + winner.indexA, first + winner.indexB, accumulatedError);
+#endif
+
+                particleA->velocity = velocityA;
+                particleB->velocity = velocityB;
+
+                eventRecord->type = PARTICLE_PARTICLE;
+                eventRecord->indexA = particleIds[winner.indexA];
+                eventRecord->indexB = particleIds[winner.indexB];
+                eventRecord->velocityA = velocityA;
+                eventRecord->velocityB = velocityB;
+
+                TRACE(TRACE_LEVEL_EVENTS, TRACE_PARTICLE_PARTICLE, first + winner.indexA, first + winner.indexB, timestep);
+            } else if (collision) {
+                global struct Particle * const particle = particles + winner.indexA;
+
+                if (winner.type == PARTICLE_WALL_X) {
+                    particle->velocity.x = -particle->velocity.x;
+                    TRACE(TRACE_LEVEL_EVENTS, TRACE_PARTICLE_WALL_X, first + winner.indexA, first + winner.indexA, timestep);
+                } else {
+                    particle->velocity.y = -particle->velocity.y;
+                    TRACE(TRACE_LEVEL_EVENTS, TRACE_PARTICLE_WALL_Y, first + winner.indexA, first + winner.indexA, timestep);
+                }
+
+                recordWallEvent(eventRecord, winner.type, particleIds[winner.indexA], particle->velocity);
+            }
+        }
+        barrier(CLK_GLOBAL_MEM_FENCE | CLK_LOCAL_MEM_FENCE);
+    }
+
+    if (localIndex == 0) {
+        // The host reads a slot for every step of the launch
+        for (uint empty = step; empty < events; empty++) {
+            timesteps[empty * systems + system] = 0;
+            stepRecords[empty * systems + system].type = NONE;
+        }
+
+        horizons[system] = horizon;
+        eventCounts[system] += step;
+    }
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+    mergeLocalOutcomeCounters(localCounters, outcomeCounters);
+}
+
+// Particles are periodically sorted by the Morton (Z-order) code of their position, so particles close in space are
+// also close in memory. The sort is a least significant digit radix sort where every system is split in chunks:
+// chunks count their digits in parallel, a scan turns the counts into offsets and every chunk scatters its keys in
+// order, which keeps the sort stable
+
+#define RADIX_BITS 4
+#define RADIX_DIGITS (1 << RADIX_BITS)
+
+// Interleaves the lower 16 bits of x with zeros
+uint spreadBits(uint x) {
+    x &= 0x0000FFFF;
+    x = (x | (x << 8)) & 0x00FF00FF;
+    x = (x | (x << 4)) & 0x0F0F0F0F;
+    x = (x | (x << 2)) & 0x33333333;
+    x = (x | (x << 1)) & 0x55555555;
+    return x;
+}
+
+kernel void calculateMortonCodes(global const struct Particle * ensembleParticles, global uint * const ensembleKeys,
+                                 global uint * const ensembleValues) {
+    const uint i = get_global_id(0);
+    const uint system = get_global_id(1);
+    const uint first = system * numberParticles;
+
+    const float2 normalized = clamp(ensembleParticles[first + i].position / (float2) (width, height), 0.0f, 1.0f);
+    const uint x = (uint) (normalized.x * 0xFFFF);
+    const uint y = (uint) (normalized.y * 0xFFFF);
+
+    ensembleKeys[first + i] = spreadBits(x) | (spreadBits(y) << 1);
+    ensembleValues[first + i] = i;
+}
+
+uint chunkStart(const uint chunk, const uint chunks) {
+    return min(chunk * ((numberParticles + chunks - 1) / chunks), numberParticles);
+}
+
+// Each system has RADIX_DIGITS * chunks counters, digit major, so that the scan gives every chunk its offset
+kernel void radixCount(global const uint * ensembleKeys, global uint * const ensembleHistograms, const uint chunks,
+                       const uint shift) {
+    const uint chunk = get_global_id(0);
+    const uint system = get_global_id(1);
+
+    global const uint * const keys = ensembleKeys + system * numberParticles;
+    global uint * const histograms = ensembleHistograms + system * RADIX_DIGITS * chunks;
+
+    uint counts[RADIX_DIGITS];
+    for (uint digit = 0; digit < RADIX_DIGITS; digit++) {
+        counts[digit] = 0;
+    }
+
+    for (uint k = chunkStart(chunk, chunks); k < chunkStart(chunk + 1, chunks); k++) {
+        counts[(keys[k] >> shift) & (RADIX_DIGITS - 1)]++;
+    }
+
+    for (uint digit = 0; digit < RADIX_DIGITS; digit++) {
+        histograms[digit * chunks + chunk] = counts[digit];
+    }
+}
+
+// Exclusive prefix sum of the counters of every system
+kernel void radixScan(global uint * const ensembleHistograms, const uint chunks) {
+    const uint system = get_global_id(0);
+
+    global uint * const histograms = ensembleHistograms + system * RADIX_DIGITS * chunks;
+
+    uint sum = 0;
+    for (uint k = 0; k < RADIX_DIGITS * chunks; k++) {
+        const uint count = histograms[k];
+        histograms[k] = sum;
+        sum += count;
+    }
+}
+
+kernel void radixScatter(global const uint * ensembleKeysInput, global const uint * ensembleValuesInput,
+                         global uint * const ensembleKeysOutput, global uint * const ensembleValuesOutput,
+                         global const uint * ensembleHistograms, const uint chunks, const uint shift) {
+    const uint chunk = get_global_id(0);
+    const uint system = get_global_id(1);
+    const uint first = system * numberParticles;
+
+    global const uint * const histograms = ensembleHistograms + system * RADIX_DIGITS * chunks;
+
+    uint offsets[RADIX_DIGITS];
+    for (uint digit = 0; digit < RADIX_DIGITS; digit++) {
+        offsets[digit] = histograms[digit * chunks + chunk];
+    }
+
+    for (uint k = chunkStart(chunk, chunks); k < chunkStart(chunk + 1, chunks); k++) {
+        const uint key = ensembleKeysInput[first + k];
+        const uint destination = offsets[(key >> shift) & (RADIX_DIGITS - 1)]++;
+
+        ensembleKeysOutput[first + destination] = key;
+        ensembleValuesOutput[first + destination] = ensembleValuesInput[first + k];
+    }
+}
+
+// Gathers the particles and their external ids in sorted order
+kernel void reorderParticles(global const struct Particle * ensembleParticlesInput,
+                             global struct Particle * const ensembleParticlesOutput,
+                             global const uint * ensembleIdsInput, global uint * const ensembleIdsOutput,
+                             global const uint * ensembleSortedValues) {
+    const uint i = get_global_id(0);
+    const uint system = get_global_id(1);
+    const uint first = system * numberParticles;
+
+    const uint source = first + ensembleSortedValues[first + i];
+
+    ensembleParticlesOutput[first + i] = ensembleParticlesInput[source];
+    ensembleIdsOutput[first + i] = ensembleIdsInput[source];
+}
@@ -0,0 +1,112 @@
+#include "trace.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define nullptr NULL
+
+struct TraceWriter openTraceWriter(const char* path, enum TraceLevel level, cl_uint capacity) {
+	struct TraceWriter traceWriter = {0};
+
+	// The kernels index the ring with the cursor modulo the capacity, which only stays in order when the cursor wraps
+	if (capacity == 0 || (capacity & (capacity - 1)) != 0) {
+		printf("Error: Trace capacity %u is not a power of two!\n", capacity);
+		traceWriter.success = false;
+		return traceWriter;
+	}
+
+	traceWriter.capacity = capacity;
+	traceWriter.ringSnapshot = calloc(capacity, sizeof(struct TraceEvent));
+	if (traceWriter.ringSnapshot == nullptr) {
+		printf("Error: Failed to allocate trace snapshot!\n");
+		traceWriter.success = false;
+		return traceWriter;
+	}
+
+	traceWriter.file = fopen(path, "wb");
+	if (traceWriter.file == nullptr) {
+		printf("Error: Failed to open trace file %s!\n", path);
+		traceWriter.success = false;
+		return traceWriter;
+	}
+
+	struct TraceFileHeader header = {
+		.version = TRACE_FILE_VERSION,
+		.level = level,
+		.capacity = capacity,
+	};
+	memcpy(header.magic, TRACE_FILE_MAGIC, sizeof(header.magic));
+
+	if (fwrite(&header, sizeof(header), 1, traceWriter.file) != 1) {
+		printf("Error: Failed to write trace header!\n");
+		traceWriter.success = false;
+		return traceWriter;
+	}
+
+	traceWriter.success = true;
+	return traceWriter;
+}
+
+bool writeTraceSnapshot(struct TraceWriter* traceWriter) {
+	// Unsigned arithmetic keeps this correct when the device cursor wraps around
+	cl_uint pending = traceWriter->cursorSnapshot - traceWriter->drainedCursor;
+
+	if (pending > traceWriter->capacity) {
+		const struct TraceEvent dropped = {
+			.type = TRACE_DROPPED,
+			.indexA = pending - traceWriter->capacity,
+		};
+		if (fwrite(&dropped, sizeof(dropped), 1, traceWriter->file) != 1) {
+			return false;
+		}
+
+		traceWriter->drainedCursor += pending - traceWriter->capacity;
+		pending = traceWriter->capacity;
+	}
+
+	// The pending events may wrap around the end of the ring
+	const cl_uint first = traceWriter->drainedCursor % traceWriter->capacity;
+	const cl_uint untilEnd = traceWriter->capacity - first < pending ? traceWriter->capacity - first : pending;
+
+	if (fwrite(traceWriter->ringSnapshot + first, sizeof(struct TraceEvent), untilEnd, traceWriter->file) != untilEnd) {
+		return false;
+	}
+	if (fwrite(traceWriter->ringSnapshot, sizeof(struct TraceEvent), pending - untilEnd, traceWriter->file)
+	    != pending - untilEnd) {
+		return false;
+	}
+
+	traceWriter->drainedCursor += pending;
+	return true;
+}
+
+void closeTraceWriter(struct TraceWriter* traceWriter) {
+	if (traceWriter->file != nullptr) {
+		fclose(traceWriter->file);
+		traceWriter->file = nullptr;
+	}
+
+	free(traceWriter->ringSnapshot);
+	traceWriter->ringSnapshot = nullptr;
+}
+
+const char* traceEventTypeName(enum TraceEventType type) {
+	switch (type) {
+		case TRACE_OVERLAP: return "Overlap";
+		case TRACE_NO_INTERSECT: return "No intersect";
+		case TRACE_GLANCING: return "Glancing";
+		case TRACE_GETTING_FARTHER: return "Getting farther";
+		case TRACE_COLLISION: return "Collision";
+		case TRACE_WALL_NO_INTERSECT: return "Wall no intersect";
+		case TRACE_WALL_GLANCING: return "Wall glancing";
+		case TRACE_WALL_GETTING_FARTHER: return "Wall getting farther";
+		case TRACE_WALL_COLLISION: return "Wall collision";
+		case TRACE_PARTICLE_PARTICLE: return "Particle collision";
+		case TRACE_PARTICLE_WALL_X: return "Wall X collision";
+		case TRACE_PARTICLE_WALL_Y: return "Wall Y collision";
+		case TRACE_COLLISION_ERROR: return "Collision error";
+		case TRACE_ZERO_TIMESTEP: return "Timestep is 0, infinite loop";
+		case TRACE_DROPPED: return "Dropped";
+		default: return "Unknown";
+	}
+}
@@ -0,0 +1,81 @@
+#ifndef COLLISIONBASEDGASSIMULATOR_TRACE_H
+#define COLLISIONBASEDGASSIMULATOR_TRACE_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#include <CL/cl.h>
+
+// The trace level and event definitions here must also be in simulator.cl
+
+enum TraceLevel {
+	TRACE_LEVEL_OFF = 0,
+	TRACE_LEVEL_EVENTS, // Resolved collisions and their energy error
+	TRACE_LEVEL_TESTS // Also every pair and wall test outcome
+};
+
+enum TraceEventType {
+	TRACE_OVERLAP = 0,
+	TRACE_NO_INTERSECT,
+	TRACE_GLANCING,
+	TRACE_GETTING_FARTHER,
+	TRACE_COLLISION,
+	TRACE_WALL_NO_INTERSECT,
+	TRACE_WALL_GLANCING,
+	TRACE_WALL_GETTING_FARTHER,
+	TRACE_WALL_COLLISION,
+	TRACE_PARTICLE_PARTICLE,
+	TRACE_PARTICLE_WALL_X,
+	TRACE_PARTICLE_WALL_Y,
+	TRACE_COLLISION_ERROR,
+	TRACE_ZERO_TIMESTEP,
+	TRACE_DROPPED // Host only, indexA is the amount of events lost to ring buffer overflow
+};
+
+// Particle indices are global, system * numberParticles + slot in the system, slots are not particle ids once the
+// particles are reordered
+struct __attribute__((packed)) TraceEvent {
+	cl_uint type;
+	cl_uint indexA;
+	cl_uint indexB;
+	cl_float value;
+};
+
+// Binary trace file: a TraceFileHeader followed by TraceEvent records until the end of the file
+
+#define TRACE_FILE_MAGIC "CBGT"
+#define TRACE_FILE_VERSION 1
+
+struct __attribute__((packed)) TraceFileHeader {
+	char magic[4];
+	cl_uint version;
+	cl_uint level;
+	cl_uint capacity;
+};
+
+struct TraceWriter {
+	FILE* file;
+	cl_uint capacity;
+
+	// Snapshot of the device ring buffer, filled asynchronously by the host
+	struct TraceEvent* ringSnapshot;
+	cl_uint cursorSnapshot;
+	cl_event snapshotEvent;
+	bool snapshotPending;
+
+	// Value of the device cursor up to which events have been written to the file
+	cl_uint drainedCursor;
+
+	bool success;
+};
+
+struct TraceWriter openTraceWriter(const char* path, enum TraceLevel level, cl_uint capacity);
+
+// Writes the events in ringSnapshot that were not written before, capacity must be a power of two
+bool writeTraceSnapshot(struct TraceWriter* traceWriter);
+
+void closeTraceWriter(struct TraceWriter* traceWriter);
+
+const char* traceEventTypeName(enum TraceEventType type);
+
+#endif //COLLISIONBASEDGASSIMULATOR_TRACE_H
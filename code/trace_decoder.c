@@ -0,0 +1,67 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+#define nullptr NULL
+
+// Prints a binary trace written by the simulator in a human readable form
+int main(int argc, char** argv) {
+	if (argc != 2) {
+		printf("Usage: %s <trace file>\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	FILE* file = fopen(argv[1], "rb");
+	if (file == nullptr) {
+		printf("Error: Failed to open trace file %s!\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+
+	struct TraceFileHeader header;
+	if (fread(&header, sizeof(header), 1, file) != 1
+	    || memcmp(header.magic, TRACE_FILE_MAGIC, sizeof(header.magic)) != 0) {
+		printf("Error: %s is not a trace file!\n", argv[1]);
+		fclose(file);
+		return EXIT_FAILURE;
+	}
+
+	if (header.version != TRACE_FILE_VERSION) {
+		printf("Error: Unsupported trace version %u!\n", header.version);
+		fclose(file);
+		return EXIT_FAILURE;
+	}
+
+	printf("Trace level %u, ring capacity %u\n", header.level, header.capacity);
+
+	struct TraceEvent event;
+	while (fread(&event, sizeof(event), 1, file) == 1) {
+		const char* name = traceEventTypeName(event.type);
+
+		switch (event.type) {
+			case TRACE_DROPPED:
+				printf("%s: %u events\n", name, event.indexA);
+				break;
+			case TRACE_ZERO_TIMESTEP:
+				printf("%s!\n", name);
+				break;
+			case TRACE_WALL_NO_INTERSECT:
+			case TRACE_WALL_GLANCING:
+			case TRACE_WALL_GETTING_FARTHER:
+				printf("%s: %u and wall at %f\n", name, event.indexA, event.value);
+				break;
+			case TRACE_WALL_COLLISION:
+			case TRACE_PARTICLE_WALL_X:
+			case TRACE_PARTICLE_WALL_Y:
+				printf("%s: %u at time %f\n", name, event.indexA, event.value);
+				break;
+			default:
+				printf("%s: %u and %u (%f)\n", name, event.indexA, event.indexB, event.value);
+				break;
+		}
+	}
+
+	fclose(file);
+	return EXIT_SUCCESS;
+}
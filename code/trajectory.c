@@ -0,0 +1,310 @@
+#include "trajectory.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define nullptr NULL
+
+struct TrajectoryWriter openTrajectoryWriter(const char* path, cl_uint systems, cl_uint particles) {
+	struct TrajectoryWriter trajectoryWriter = {0};
+
+	trajectoryWriter.particles = particles;
+
+	trajectoryWriter.file = fopen(path, "wb");
+	if (trajectoryWriter.file == nullptr) {
+		printf("Error: Failed to open trajectory file %s!\n", path);
+		trajectoryWriter.success = false;
+		return trajectoryWriter;
+	}
+
+	struct TrajectoryFileHeader header = {
+		.version = TRAJECTORY_FILE_VERSION,
+		.systems = systems,
+		.particles = particles,
+	};
+	memcpy(header.magic, TRAJECTORY_FILE_MAGIC, sizeof(header.magic));
+
+	if (fwrite(&header, sizeof(header), 1, trajectoryWriter.file) != 1) {
+		printf("Error: Failed to write trajectory header!\n");
+		trajectoryWriter.success = false;
+		return trajectoryWriter;
+	}
+
+	trajectoryWriter.success = true;
+	return trajectoryWriter;
+}
+
+bool writeTrajectoryKeyframe(struct TrajectoryWriter* trajectoryWriter, cl_uint system, double time,
+                             const struct Particle* particles) {
+	if (trajectoryWriter->keyframeCount == trajectoryWriter->keyframeCapacity) {
+		const size_t capacity = trajectoryWriter->keyframeCapacity == 0 ? 64 : trajectoryWriter->keyframeCapacity * 2;
+		struct TrajectoryKeyframe* keyframes = realloc(trajectoryWriter->keyframes,
+		                                               capacity * sizeof(struct TrajectoryKeyframe));
+		if (keyframes == nullptr) {
+			return false;
+		}
+
+		trajectoryWriter->keyframes = keyframes;
+		trajectoryWriter->keyframeCapacity = capacity;
+	}
+
+	const long offset = ftell(trajectoryWriter->file);
+	if (offset < 0) {
+		return false;
+	}
+
+	const struct TrajectoryRecordHeader header = {
+		.type = TRAJECTORY_KEYFRAME,
+		.system = system,
+		.time = time,
+	};
+	if (fwrite(&header, sizeof(header), 1, trajectoryWriter->file) != 1
+	    || fwrite(particles, sizeof(struct Particle), trajectoryWriter->particles, trajectoryWriter->file)
+	       != trajectoryWriter->particles) {
+		return false;
+	}
+
+	trajectoryWriter->keyframes[trajectoryWriter->keyframeCount++] = (struct TrajectoryKeyframe) {
+		.time = time,
+		.system = system,
+		.offset = (cl_ulong) offset,
+	};
+	return true;
+}
+
+bool writeTrajectoryEvent(struct TrajectoryWriter* trajectoryWriter, cl_uint system, double time,
+                          const struct EventRecord* event) {
+	const struct TrajectoryRecordHeader header = {
+		.type = TRAJECTORY_EVENT,
+		.system = system,
+		.time = time,
+	};
+
+	return fwrite(&header, sizeof(header), 1, trajectoryWriter->file) == 1
+	       && fwrite(event, sizeof(struct EventRecord), 1, trajectoryWriter->file) == 1;
+}
+
+bool closeTrajectoryWriter(struct TrajectoryWriter* trajectoryWriter) {
+	bool success = true;
+
+	if (trajectoryWriter->file != nullptr) {
+		const long indexOffset = ftell(trajectoryWriter->file);
+
+		struct TrajectoryFileFooter footer = {
+			.indexOffset = (cl_ulong) indexOffset,
+			.keyframes = trajectoryWriter->keyframeCount,
+		};
+		memcpy(footer.magic, TRAJECTORY_INDEX_MAGIC, sizeof(footer.magic));
+
+		success = indexOffset >= 0
+		          && fwrite(trajectoryWriter->keyframes, sizeof(struct TrajectoryKeyframe),
+		                    trajectoryWriter->keyframeCount, trajectoryWriter->file) == trajectoryWriter->keyframeCount
+		          && fwrite(&footer, sizeof(footer), 1, trajectoryWriter->file) == 1;
+
+		success &= fclose(trajectoryWriter->file) == 0;
+		trajectoryWriter->file = nullptr;
+	}
+
+	free(trajectoryWriter->keyframes);
+	trajectoryWriter->keyframes = nullptr;
+	trajectoryWriter->keyframeCount = 0;
+	trajectoryWriter->keyframeCapacity = 0;
+
+	return success;
+}
+
+static size_t recordPayloadSize(const struct TrajectoryReader* trajectoryReader, cl_uint type) {
+	return type == TRAJECTORY_KEYFRAME ?
+		sizeof(struct Particle) * trajectoryReader->header.particles : sizeof(struct EventRecord);
+}
+
+static bool readKeyframeIndex(struct TrajectoryReader* trajectoryReader) {
+	struct TrajectoryFileFooter footer;
+	if (fseek(trajectoryReader->file, -(long) sizeof(footer), SEEK_END) != 0
+	    || fread(&footer, sizeof(footer), 1, trajectoryReader->file) != 1
+	    || memcmp(footer.magic, TRAJECTORY_INDEX_MAGIC, sizeof(footer.magic)) != 0) {
+		return false;
+	}
+
+	trajectoryReader->keyframes = calloc(footer.keyframes, sizeof(struct TrajectoryKeyframe));
+	if (trajectoryReader->keyframes == nullptr && footer.keyframes > 0) {
+		return false;
+	}
+
+	if (fseek(trajectoryReader->file, (long) footer.indexOffset, SEEK_SET) != 0
+	    || fread(trajectoryReader->keyframes, sizeof(struct TrajectoryKeyframe), footer.keyframes,
+	             trajectoryReader->file) != footer.keyframes) {
+		return false;
+	}
+
+	trajectoryReader->keyframeCount = footer.keyframes;
+	return true;
+}
+
+// For files whose writer was not closed, every record is visited but only the keyframe headers are kept
+static bool scanKeyframeIndex(struct TrajectoryReader* trajectoryReader) {
+	size_t capacity = 0;
+
+	free(trajectoryReader->keyframes);
+	trajectoryReader->keyframes = nullptr;
+	trajectoryReader->keyframeCount = 0;
+
+	if (fseek(trajectoryReader->file, sizeof(struct TrajectoryFileHeader), SEEK_SET) != 0) {
+		return false;
+	}
+
+	while (true) {
+		const long offset = ftell(trajectoryReader->file);
+
+		struct TrajectoryRecordHeader header;
+		if (fread(&header, sizeof(header), 1, trajectoryReader->file) != 1) {
+			return true;
+		}
+
+		if (header.type == TRAJECTORY_KEYFRAME) {
+			if (trajectoryReader->keyframeCount == capacity) {
+				capacity = capacity == 0 ? 64 : capacity * 2;
+				struct TrajectoryKeyframe* keyframes = realloc(trajectoryReader->keyframes,
+				                                               capacity * sizeof(struct TrajectoryKeyframe));
+				if (keyframes == nullptr) {
+					return false;
+				}
+				trajectoryReader->keyframes = keyframes;
+			}
+
+			trajectoryReader->keyframes[trajectoryReader->keyframeCount++] = (struct TrajectoryKeyframe) {
+				.time = header.time,
+				.system = header.system,
+				.offset = (cl_ulong) offset,
+			};
+		}
+
+		if (fseek(trajectoryReader->file, (long) recordPayloadSize(trajectoryReader, header.type), SEEK_CUR) != 0) {
+			return false;
+		}
+	}
+}
+
+struct TrajectoryReader openTrajectoryReader(const char* path) {
+	struct TrajectoryReader trajectoryReader = {0};
+
+	trajectoryReader.file = fopen(path, "rb");
+	if (trajectoryReader.file == nullptr) {
+		printf("Error: Failed to open trajectory file %s!\n", path);
+		trajectoryReader.success = false;
+		return trajectoryReader;
+	}
+
+	if (fread(&trajectoryReader.header, sizeof(trajectoryReader.header), 1, trajectoryReader.file) != 1
+	    || memcmp(trajectoryReader.header.magic, TRAJECTORY_FILE_MAGIC, sizeof(trajectoryReader.header.magic)) != 0) {
+		printf("Error: %s is not a trajectory file!\n", path);
+		trajectoryReader.success = false;
+		return trajectoryReader;
+	}
+
+	if (trajectoryReader.header.version != TRAJECTORY_FILE_VERSION) {
+		printf("Error: Unsupported trajectory version %u!\n", trajectoryReader.header.version);
+		trajectoryReader.success = false;
+		return trajectoryReader;
+	}
+
+	trajectoryReader.updateTimes = calloc(trajectoryReader.header.particles, sizeof(double));
+	if (trajectoryReader.updateTimes == nullptr) {
+		printf("Error: Failed to allocate trajectory reader!\n");
+		trajectoryReader.success = false;
+		return trajectoryReader;
+	}
+
+	if (!readKeyframeIndex(&trajectoryReader) && !scanKeyframeIndex(&trajectoryReader)) {
+		printf("Error: Failed to read the keyframes of %s!\n", path);
+		trajectoryReader.success = false;
+		return trajectoryReader;
+	}
+
+	trajectoryReader.success = true;
+	return trajectoryReader;
+}
+
+static void moveParticle(struct Particle* particle, double from, double to) {
+	particle->position.x += (cl_float) (particle->velocity.x * (to - from));
+	particle->position.y += (cl_float) (particle->velocity.y * (to - from));
+}
+
+bool readTrajectoryState(struct TrajectoryReader* trajectoryReader, cl_uint system, double time,
+                         struct Particle* particles) {
+	const struct TrajectoryKeyframe* keyframe = nullptr;
+	for (size_t k = 0; k < trajectoryReader->keyframeCount; k++) {
+		if (trajectoryReader->keyframes[k].system == system && trajectoryReader->keyframes[k].time <= time) {
+			keyframe = &trajectoryReader->keyframes[k];
+		}
+	}
+
+	if (keyframe == nullptr) {
+		return false;
+	}
+
+	const cl_uint count = trajectoryReader->header.particles;
+
+	struct TrajectoryRecordHeader header;
+	if (fseek(trajectoryReader->file, (long) keyframe->offset, SEEK_SET) != 0
+	    || fread(&header, sizeof(header), 1, trajectoryReader->file) != 1
+	    || fread(particles, sizeof(struct Particle), count, trajectoryReader->file) != count) {
+		return false;
+	}
+
+	for (cl_uint i = 0; i < count; i++) {
+		trajectoryReader->updateTimes[i] = keyframe->time;
+	}
+
+	// Only the particles in an event are moved to it, everything else is moved once at the end
+	while (fread(&header, sizeof(header), 1, trajectoryReader->file) == 1) {
+		if (header.system != system) {
+			if (fseek(trajectoryReader->file, (long) recordPayloadSize(trajectoryReader, header.type), SEEK_CUR) != 0) {
+				return false;
+			}
+			continue;
+		}
+
+		// Any later keyframe of the system is past the time, or the start of a new timeline
+		if (header.type == TRAJECTORY_KEYFRAME || header.time > time) {
+			break;
+		}
+
+		struct EventRecord event;
+		if (fread(&event, sizeof(event), 1, trajectoryReader->file) != 1) {
+			return false;
+		}
+
+		if (event.indexA >= count || event.indexB >= count) {
+			return false;
+		}
+
+		moveParticle(&particles[event.indexA], trajectoryReader->updateTimes[event.indexA], header.time);
+		particles[event.indexA].velocity = event.velocityA;
+		trajectoryReader->updateTimes[event.indexA] = header.time;
+
+		if (event.indexB != event.indexA) {
+			moveParticle(&particles[event.indexB], trajectoryReader->updateTimes[event.indexB], header.time);
+			particles[event.indexB].velocity = event.velocityB;
+			trajectoryReader->updateTimes[event.indexB] = header.time;
+		}
+	}
+
+	for (cl_uint i = 0; i < count; i++) {
+		moveParticle(&particles[i], trajectoryReader->updateTimes[i], time);
+	}
+
+	return true;
+}
+
+void closeTrajectoryReader(struct TrajectoryReader* trajectoryReader) {
+	if (trajectoryReader->file != nullptr) {
+		fclose(trajectoryReader->file);
+		trajectoryReader->file = nullptr;
+	}
+
+	free(trajectoryReader->keyframes);
+	trajectoryReader->keyframes = nullptr;
+	free(trajectoryReader->updateTimes);
+	trajectoryReader->updateTimes = nullptr;
+}
@@ -0,0 +1,97 @@
+#ifndef COLLISIONBASEDGASSIMULATOR_TRAJECTORY_H
+#define COLLISIONBASEDGASSIMULATOR_TRAJECTORY_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#include <CL/cl.h>
+
+#include "datatypes.h"
+
+// Event sourced trajectory file: motion between collisions is ballistic, so only the collisions are stored, with
+// periodic keyframes of every system to replay from. The file is a TrajectoryFileHeader followed by records, each one
+// a TrajectoryRecordHeader and its payload, and ends with the keyframe index and a TrajectoryFileFooter
+
+#define TRAJECTORY_FILE_MAGIC "CBGJ"
+#define TRAJECTORY_INDEX_MAGIC "CBGI"
+#define TRAJECTORY_FILE_VERSION 1
+
+// Default events between keyframes of a recorded trajectory
+static const cl_uint trajectoryKeyframeInterval = 1000;
+
+struct __attribute__((packed)) TrajectoryFileHeader {
+	char magic[4];
+	cl_uint version;
+	cl_uint systems;
+	cl_uint particles;
+};
+
+enum TrajectoryRecordType {
+	TRAJECTORY_KEYFRAME = 0, // Followed by the particles of the system in id order
+	TRAJECTORY_EVENT // Followed by an EventRecord
+};
+
+struct __attribute__((packed)) TrajectoryRecordHeader {
+	cl_uint type;
+	cl_uint system;
+	cl_double time;
+};
+
+struct __attribute__((packed)) TrajectoryKeyframe {
+	cl_double time;
+	cl_uint system;
+	cl_ulong offset; // Of the TrajectoryRecordHeader
+};
+
+// Missing when the writer was not closed, the reader then scans the records instead
+struct __attribute__((packed)) TrajectoryFileFooter {
+	cl_ulong indexOffset;
+	cl_ulong keyframes;
+	char magic[4];
+};
+
+struct TrajectoryWriter {
+	FILE* file;
+	cl_uint particles;
+
+	struct TrajectoryKeyframe* keyframes;
+	size_t keyframeCount;
+	size_t keyframeCapacity;
+
+	bool success;
+};
+
+struct TrajectoryWriter openTrajectoryWriter(const char* path, cl_uint systems, cl_uint particles);
+
+bool writeTrajectoryKeyframe(struct TrajectoryWriter* trajectoryWriter, cl_uint system, double time,
+                             const struct Particle* particles);
+
+bool writeTrajectoryEvent(struct TrajectoryWriter* trajectoryWriter, cl_uint system, double time,
+                          const struct EventRecord* event);
+
+// Writes the keyframe index
+bool closeTrajectoryWriter(struct TrajectoryWriter* trajectoryWriter);
+
+struct TrajectoryReader {
+	FILE* file;
+	struct TrajectoryFileHeader header;
+
+	struct TrajectoryKeyframe* keyframes;
+	size_t keyframeCount;
+
+	// Time each particle was last updated at while replaying
+	double* updateTimes;
+
+	bool success;
+};
+
+struct TrajectoryReader openTrajectoryReader(const char* path);
+
+// Reconstructs the particles of a system at a time from the last keyframe at or before it. When the particles of a
+// system were set again while recording, the last timeline wins
+bool readTrajectoryState(struct TrajectoryReader* trajectoryReader, cl_uint system, double time,
+                         struct Particle* particles);
+
+void closeTrajectoryReader(struct TrajectoryReader* trajectoryReader);
+
+#endif //COLLISIONBASEDGASSIMULATOR_TRAJECTORY_H
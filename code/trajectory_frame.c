@@ -0,0 +1,47 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "trajectory.h"
+
+#define nullptr NULL
+
+// Prints the particles of a system at a time, reconstructed from a trajectory written by the simulator
+int main(int argc, char** argv) {
+	if (argc != 4) {
+		printf("Usage: %s <trajectory file> <system> <time>\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	const cl_uint system = (cl_uint) strtoul(argv[2], nullptr, 10);
+	const double time = strtod(argv[3], nullptr);
+
+	struct TrajectoryReader trajectoryReader = openTrajectoryReader(argv[1]);
+	if (!trajectoryReader.success) {
+		closeTrajectoryReader(&trajectoryReader);
+		return EXIT_FAILURE;
+	}
+
+	if (system >= trajectoryReader.header.systems) {
+		printf("Error: There is no system %u!\n", system);
+		closeTrajectoryReader(&trajectoryReader);
+		return EXIT_FAILURE;
+	}
+
+	struct Particle* particles = calloc(trajectoryReader.header.particles, sizeof(struct Particle));
+	if (particles == nullptr || !readTrajectoryState(&trajectoryReader, system, time, particles)) {
+		printf("Error: Failed to reconstruct system %u at time %f!\n", system, time);
+		free(particles);
+		closeTrajectoryReader(&trajectoryReader);
+		return EXIT_FAILURE;
+	}
+
+	printf("System %u at time %f, %zu keyframes\n", system, time, trajectoryReader.keyframeCount);
+	for (cl_uint i = 0; i < trajectoryReader.header.particles; i++) {
+		printf("%u: position (%f, %f) velocity (%f, %f)\n", i, particles[i].position.x, particles[i].position.y,
+		       particles[i].velocity.x, particles[i].velocity.y);
+	}
+
+	free(particles);
+	closeTrajectoryReader(&trajectoryReader);
+	return EXIT_SUCCESS;
+}